@@ -0,0 +1,94 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+//!	aabb struct.
+/*!
+	An axis aligned bounding box, used to build the acceleration structures.
+*/
+typedef struct aabb
+{
+	point3 minimum;
+	point3 maximum;
+
+	aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+	aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+	point3 min() const
+	{
+		return minimum;
+	}
+	point3 max() const
+	{
+		return maximum;
+	}
+	point3 centroid() const
+	{
+		return 0.5 * (minimum + maximum);
+	}
+
+	//!	function to return the axis the box is longest along.
+	int longest_axis() const
+	{
+		vec3 d = maximum - minimum;
+		return d.x() > d.y() ? (d.x() > d.z() ? 0 : 2) : (d.y() > d.z() ? 1 : 2);
+	}
+
+	//!	function to return the surface area, zero for an empty box.
+	double area() const
+	{
+		vec3 d = maximum - minimum;
+		if (d.x() < 0 || d.y() < 0 || d.z() < 0)
+		{
+			return 0;
+		}
+		return 2 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+	}
+
+	//!	function for the slab test.
+	/*!
+		\param r ray& the ray.
+		\param t_min double lower end of the range.
+		\param t_max double upper end of the range.
+		\return bool true if the ray passes through the box inside the range.
+	*/
+	bool hit(const ray& r, double t_min, double t_max) const
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			auto inv_d = 1.0 / r.direction()[a];
+			auto t0 = (minimum[a] - r.origin()[a]) * inv_d;
+			auto t1 = (maximum[a] - r.origin()[a]) * inv_d;
+			if (inv_d < 0.0)
+			{
+				std::swap(t0, t1);
+			}
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
+			if (t_max < t_min)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+} aabb;
+
+//!	function to return the box enclosing two boxes.
+inline aabb surrounding_box(const aabb& box0, const aabb& box1)
+{
+	point3 small(std::fmin(box0.min().x(), box1.min().x()),
+		     std::fmin(box0.min().y(), box1.min().y()),
+		     std::fmin(box0.min().z(), box1.min().z()));
+
+	point3 big(std::fmax(box0.max().x(), box1.max().x()),
+		   std::fmax(box0.max().y(), box1.max().y()),
+		   std::fmax(box0.max().z(), box1.max().z()));
+
+	return aabb(small, big);
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//!	How pool workers are placed on hardware threads.
+enum pinning { PIN_NONE, PIN_COMPACT, PIN_SCATTER };
+
+//!	numa_topology struct.
+/*!
+	The hardware threads of each NUMA node. Machines without NUMA information, or where it
+	cannot be read, show up as a single node holding every hardware thread.
+*/
+typedef struct numa_topology
+{
+	std::vector<std::vector<int>> node_cpus;
+
+	size_t nodes() const
+	{
+		return node_cpus.size();
+	}
+
+	static numa_topology detect();
+	std::vector<int> placement(pinning mode, size_t num_threads) const;
+	int node_of(int cpu) const;
+} numa_topology;
+
+// Parses a sysfs cpulist such as "0-7,16-23".
+inline std::vector<int> parse_cpulist(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::stringstream in(list);
+	std::string range;
+	while (std::getline(in, range, ','))
+	{
+		int first, last;
+		auto dash = range.find('-');
+		first = std::atoi(range.c_str());
+		last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+		for (int cpu = first; cpu <= last; ++cpu)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+numa_topology numa_topology::detect()
+{
+	numa_topology topo;
+
+#ifdef _WIN32
+	ULONG highest = 0;
+	if (GetNumaHighestNodeNumber(&highest))
+	{
+		for (ULONG node = 0; node <= highest; ++node)
+		{
+			ULONGLONG mask = 0;
+			std::vector<int> cpus;
+			if (GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask))
+			{
+				for (int cpu = 0; cpu < 64; ++cpu)
+				{
+					if (mask & (1ull << cpu))
+					{
+						cpus.push_back(cpu);
+					}
+				}
+			}
+			if (!cpus.empty())
+			{
+				topo.node_cpus.push_back(cpus);
+			}
+		}
+	}
+#else
+	for (int node = 0; ; ++node)
+	{
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!file || !std::getline(file, list))
+		{
+			break;
+		}
+		auto cpus = parse_cpulist(list);
+		if (!cpus.empty())
+		{
+			topo.node_cpus.push_back(cpus);
+		}
+	}
+#endif
+
+	if (topo.node_cpus.empty())
+	{
+		std::vector<int> cpus;
+		for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+		{
+			cpus.push_back(static_cast<int>(cpu));
+		}
+		topo.node_cpus.push_back(cpus);
+	}
+	return topo;
+}
+
+//!	function to pick a hardware thread for each worker.
+/*!
+	Compact fills node 0 before moving on to node 1, keeping workers close together and
+	sharing caches. Scatter deals workers round robin over the nodes, spreading them over
+	every memory controller. Workers beyond the number of hardware threads wrap around.
+	\param mode pinning the policy, PIN_NONE gives -1 for every worker.
+	\param num_threads size_t number of workers.
+	\return std::vector<int> the hardware thread of each worker.
+*/
+std::vector<int> numa_topology::placement(pinning mode, size_t num_threads) const
+{
+	std::vector<int> order;
+	if (mode == PIN_COMPACT)
+	{
+		for (const auto& cpus : node_cpus)
+		{
+			order.insert(order.end(), cpus.begin(), cpus.end());
+		}
+	}
+	else if (mode == PIN_SCATTER)
+	{
+		size_t longest = 0;
+		for (const auto& cpus : node_cpus)
+		{
+			longest = std::max(longest, cpus.size());
+		}
+		for (size_t i = 0; i < longest; ++i)
+		{
+			for (const auto& cpus : node_cpus)
+			{
+				if (i < cpus.size())
+				{
+					order.push_back(cpus[i]);
+				}
+			}
+		}
+	}
+
+	std::vector<int> result(num_threads, -1);
+	for (size_t i = 0; i < num_threads && !order.empty(); ++i)
+	{
+		result[i] = order[i % order.size()];
+	}
+	return result;
+}
+
+//!	function to return the node a hardware thread belongs to, 0 if unknown.
+int numa_topology::node_of(int cpu) const
+{
+	for (size_t node = 0; node < node_cpus.size(); ++node)
+	{
+		for (int c : node_cpus[node])
+		{
+			if (c == cpu)
+			{
+				return static_cast<int>(node);
+			}
+		}
+	}
+	return 0;
+}
+
+//!	function to pin the calling thread to one hardware thread.
+/*!
+	\return bool false if the operating system refused.
+*/
+inline bool pin_current_thread(int cpu)
+{
+	if (cpu < 0)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), 1ull << cpu) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+//!	function to return the NUMA node the calling thread was placed on.
+/*!
+	Set by pool workers when they are pinned, every other thread reports node 0.
+*/
+inline int& current_numa_node()
+{
+	thread_local int node = 0;
+	return node;
+}
+
+#endif
@@ -4,5 +4,5 @@ mkdir ..\bin
 mkdir ..\data
 pushd ..\bin
 Rem cl /Zi ..\src\main.cc
-cl  /EHsc /O2 ..\src\main.cc
+cl  /EHsc /O2 /arch:AVX2 ..\src\main.cc
 popd
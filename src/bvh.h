@@ -0,0 +1,822 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+//!	bvh_node struct.
+/*!
+	A plain binary bounding volume hierarchy, every node a heap allocated hittable holding
+	a full double precision box. Split at the centroid median of the longest axis. Kept as
+	the uncompressed reference qbvh is measured against.
+*/
+typedef struct bvh_node : hittable
+{
+	std::shared_ptr<hittable> left;
+	std::shared_ptr<hittable> right;
+	aabb box;
+
+	bvh_node() {}
+	bvh_node(const hittable_list& list)
+	{
+		auto objects = list.objects; // Create a modifiable array of the source scene objects
+		build(objects, 0, objects.size());
+	}
+	bvh_node(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end)
+	{
+		build(objects, start, end);
+	}
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		output_box = box;
+		return true;
+	}
+
+	size_t node_count() const;
+
+	private:
+	void build(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end);
+} bvh_node;
+
+inline aabb object_box(const std::shared_ptr<hittable>& object)
+{
+	aabb box;
+	object->bounding_box(box);
+	return box;
+}
+
+// Sorts its part of objects in place, the children work on the two halves.
+void bvh_node::build(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end)
+{
+	aabb centroids;
+	for (size_t i = start; i < end; ++i)
+	{
+		auto c = object_box(objects[i]).centroid();
+		centroids = surrounding_box(centroids, aabb(c, c));
+	}
+	int axis = centroids.longest_axis();
+
+	size_t object_span = end - start;
+	if (object_span == 1)
+	{
+		left = right = objects[start];
+	}
+	else if (object_span == 2)
+	{
+		left = objects[start];
+		right = objects[start+1];
+	}
+	else
+	{
+		auto mid = start + object_span/2;
+		std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+			[axis](const std::shared_ptr<hittable>& a, const std::shared_ptr<hittable>& b)
+			{
+				return object_box(a).centroid()[axis] < object_box(b).centroid()[axis];
+			});
+
+		left = std::make_shared<bvh_node>(objects, start, mid);
+		right = std::make_shared<bvh_node>(objects, mid, end);
+	}
+
+	box = surrounding_box(object_box(left), object_box(right));
+}
+
+bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	if (!box.hit(r, t_min, t_max))
+	{
+		return false;
+	}
+
+	bool hit_left = left->hit(r, t_min, t_max, rec);
+	bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+
+	return hit_left || hit_right;
+}
+
+bool bvh_node::occluded(const ray& r, double t_min, double t_max) const
+{
+	return box.hit(r, t_min, t_max) && (left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max));
+}
+
+size_t bvh_node::node_count() const
+{
+	size_t count = 1;
+	for (const auto& child : {left, right})
+	{
+		auto node = std::dynamic_pointer_cast<bvh_node>(child);
+		if (node)
+		{
+			count += node->node_count();
+		}
+	}
+	return count;
+}
+
+//!	qbvh_node struct.
+/*!
+	One 4-wide node in exactly one 64 byte cache line. The children's boxes are stored as
+	8 bit offsets from the node's own float origin, in steps of a power of two per axis
+	picked so 255 steps cover the node. Offsets are rounded outwards, so a decoded box
+	always contains the exact one and no hit can be lost, only a few extra boxes entered.
+
+	A child is either another node or a leaf, a leaf being a range of up to four primitives
+	in qbvh::prims. Missing children are marked by lo > hi on the x axis.
+*/
+typedef struct alignas(64) qbvh_node
+{
+	float origin[3];
+	int8_t exponent[3];	// step along each axis is 2^exponent
+	uint8_t leaf_mask;	// bit i set if child i is a leaf
+	uint8_t lo[3][4];
+	uint8_t hi[3][4];
+	uint32_t child[4];	// node index, or index into qbvh::leaves for a leaf
+} qbvh_node;
+
+static_assert(sizeof(qbvh_node) == 64, "qbvh_node must fill exactly one cache line");
+
+// 2^e built straight from the exponent bits, ldexp is far too slow for the inner loop.
+inline double power_of_two(int e)
+{
+	uint64_t bits = static_cast<uint64_t>(e + 1023) << 52;
+	double d;
+	std::memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+//!	function to ask for a cache line ahead of use, without waiting for it.
+inline void prefetch(const void* p)
+{
+#if defined(_MSC_VER)
+	_mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+	__builtin_prefetch(p);
+#endif
+}
+
+//!	qbvh struct.
+/*!
+	A compressed 4-wide bounding volume hierarchy stored as one flat array of cache line
+	nodes. Built as a binary tree first, then each node pulls up the children of its
+	largest children until it has four. Leaves made only of triangles also get a triangle4
+	packet so they are tested four at a time.
+*/
+typedef struct qbvh : hittable
+{
+	typedef struct leaf
+	{
+		uint32_t first;		// into prims
+		uint32_t count;
+		int32_t packet;		// into packets, -1 if the leaf holds anything but triangles
+	} leaf;
+
+	std::vector<qbvh_node> nodes;
+	std::vector<leaf> leaves;
+	std::vector<triangle4> packets;
+	std::vector<std::shared_ptr<hittable>> prims;
+	aabb bounds;
+	int stream_lanes = 8;	// rays hit_stream() keeps in flight, at most max_stream_lanes
+	bool stream_prefetch = true;
+	int depth = 0;		// node levels, the root being 1
+
+	static const int max_stream_lanes = 32;
+	// A visited node pops one stack entry and pushes at most four, so a walk never holds
+	// more than 3 * depth + 1. Median splits keep depth at most 32 for 2^32 primitives.
+	static const int max_stack = 3 * 32 + 1;
+
+	qbvh(const hittable_list& list);
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+	virtual void hit_stream(const ray* rays, size_t count, double t_min, double t_max, hit_record* recs, bool* hits) const override;
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		output_box = bounds;
+		return !prims.empty();
+	}
+
+	//!	function to return the memory the tree owns per primitive in bytes, triangle packets included.
+	double bytes_per_primitive() const
+	{
+		return prims.empty() ? 0 : static_cast<double>(nodes.size() * sizeof(qbvh_node) + leaves.size() * sizeof(leaf) + packets.size() * sizeof(triangle4)) / prims.size();
+	}
+
+	private:
+	typedef struct build_node
+	{
+		aabb box;
+		int left = -1;
+		int right = -1;
+		size_t first = 0;
+		size_t count = 0;	// non zero for a leaf
+	} build_node;
+
+	typedef struct ray_setup
+	{
+		double org[3];
+		double inv_dir[3];
+	} ray_setup;
+
+	std::vector<build_node> build;
+	std::vector<aabb> prim_boxes;
+
+	int build_binary(size_t start, size_t end);
+	uint32_t emit(int binary_index, int level);
+	uint32_t emit_leaf(const build_node& b);
+	int child_hits(const qbvh_node& node, const ray_setup& rs, double t_min, double t_max, double* t_near) const;
+	bool hit_leaf(const leaf& l, const ray& r, const watertight_ray& wr, double t_min, double& closest, hit_record& rec) const;
+	void prefetch_entry(uint32_t entry) const;
+} qbvh;
+
+qbvh::qbvh(const hittable_list& list)
+{
+	prims = list.objects;
+	if (prims.empty())
+	{
+		return;
+	}
+
+	for (const auto& object : prims)
+	{
+		prim_boxes.push_back(object_box(object));
+	}
+
+	int root = build_binary(0, prims.size());
+	bounds = build[root].box;
+
+	if (build[root].count > 0)
+	{
+		// A single leaf still needs a node above it.
+		build_node top;
+		top.box = build[root].box;
+		top.left = root;
+		build.push_back(top);
+		root = static_cast<int>(build.size()) - 1;
+	}
+	emit(root, 1);
+	assert(3 * depth + 1 <= max_stack);
+
+	build.clear();
+	build.shrink_to_fit();
+	prim_boxes.clear();
+	prim_boxes.shrink_to_fit();
+}
+
+// Centroid median split on the longest axis, leaves of at most four primitives.
+int qbvh::build_binary(size_t start, size_t end)
+{
+	build_node b;
+	aabb centroids;
+	for (size_t i = start; i < end; ++i)
+	{
+		b.box = surrounding_box(b.box, prim_boxes[i]);
+		auto c = prim_boxes[i].centroid();
+		centroids = surrounding_box(centroids, aabb(c, c));
+	}
+
+	if (end - start <= 4)
+	{
+		b.first = start;
+		b.count = end - start;
+		build.push_back(b);
+		return static_cast<int>(build.size()) - 1;
+	}
+
+	int axis = centroids.longest_axis();
+	size_t mid = start + (end - start) / 2;
+
+	std::vector<size_t> order(end - start);
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = start + i;
+	}
+	std::nth_element(order.begin(), order.begin() + (mid - start), order.end(), [&](size_t a, size_t c)
+	{
+		return prim_boxes[a].centroid()[axis] < prim_boxes[c].centroid()[axis];
+	});
+
+	std::vector<std::shared_ptr<hittable>> sorted_prims(order.size());
+	std::vector<aabb> sorted_boxes(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		sorted_prims[i] = prims[order[i]];
+		sorted_boxes[i] = prim_boxes[order[i]];
+	}
+	std::copy(sorted_prims.begin(), sorted_prims.end(), prims.begin() + start);
+	std::copy(sorted_boxes.begin(), sorted_boxes.end(), prim_boxes.begin() + start);
+
+	b.left = build_binary(start, mid);
+	b.right = build_binary(mid, end);
+	build.push_back(b);
+	return static_cast<int>(build.size()) - 1;
+}
+
+uint32_t qbvh::emit_leaf(const build_node& b)
+{
+	leaf l;
+	l.first = static_cast<uint32_t>(b.first);
+	l.count = static_cast<uint32_t>(b.count);
+	l.packet = -1;
+
+	triangle4 packet;
+	bool all_triangles = true;
+	for (size_t i = 0; i < b.count && all_triangles; ++i)
+	{
+		auto tri = dynamic_cast<const triangle*>(prims[b.first + i].get());
+		if (tri)
+		{
+			packet.set(static_cast<int>(i), tri);
+		}
+		all_triangles = tri != nullptr;
+	}
+	if (all_triangles)
+	{
+		l.packet = static_cast<int32_t>(packets.size());
+		packets.push_back(packet);
+	}
+
+	leaves.push_back(l);
+	return static_cast<uint32_t>(leaves.size()) - 1;
+}
+
+// Turns a binary node into a 4-wide node, returns its index in nodes.
+uint32_t qbvh::emit(int binary_index, int level)
+{
+	depth = std::max(depth, level);
+
+	// Open up the interior child with the largest area until there are four.
+	std::vector<int> children;
+	const build_node& b = build[binary_index];
+	children.push_back(b.left);
+	if (b.right >= 0)
+	{
+		children.push_back(b.right);
+	}
+	while (children.size() < 4)
+	{
+		int widest = -1;
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			if (build[children[i]].count == 0 && (widest < 0 || build[children[i]].box.area() > build[children[widest]].box.area()))
+			{
+				widest = static_cast<int>(i);
+			}
+		}
+		if (widest < 0)
+		{
+			break;
+		}
+		int opened = children[widest];
+		children[widest] = build[opened].left;
+		children.push_back(build[opened].right);
+	}
+
+	uint32_t index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(qbvh_node());
+
+	// Quantization frame, the origin is rounded down to a float and the step is the
+	// smallest power of two that covers the node in 255 steps.
+	qbvh_node node;
+	std::memset(&node, 0, sizeof(node));
+	aabb box;
+	for (int c : children)
+	{
+		box = surrounding_box(box, build[c].box);
+	}
+
+	double origin[3], step[3];
+	for (int a = 0; a < 3; ++a)
+	{
+		float o = static_cast<float>(box.min()[a]);
+		if (o > box.min()[a])
+		{
+			o = std::nextafter(o, -std::numeric_limits<float>::infinity());
+		}
+		node.origin[a] = o;
+		origin[a] = o;
+
+		double extent = box.max()[a] - origin[a];
+		int e = extent > 0 ? static_cast<int>(std::ceil(std::log2(extent / 255.0))) : -100;
+		e = std::max(-100, std::min(100, e));
+		// log2 can land a hair low, make sure 255 steps really reach the top.
+		while (origin[a] + 255.0 * std::ldexp(1.0, e) < box.max()[a])
+		{
+			++e;
+		}
+		node.exponent[a] = static_cast<int8_t>(e);
+		step[a] = std::ldexp(1.0, e);
+	}
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i >= static_cast<int>(children.size()))
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				node.lo[a][i] = 255;
+				node.hi[a][i] = 0;
+			}
+			node.child[i] = 0;
+			continue;
+		}
+
+		const aabb& cb = build[children[i]].box;
+		for (int a = 0; a < 3; ++a)
+		{
+			double lo = std::floor((cb.min()[a] - origin[a]) / step[a]);
+			double hi = std::ceil((cb.max()[a] - origin[a]) / step[a]);
+			node.lo[a][i] = static_cast<uint8_t>(clamp(lo, 0, 255));
+			node.hi[a][i] = static_cast<uint8_t>(clamp(hi, 0, 255));
+		}
+	}
+
+	for (int i = 0; i < static_cast<int>(children.size()); ++i)
+	{
+		const build_node& cn = build[children[i]];
+		if (cn.count > 0)
+		{
+			node.leaf_mask |= 1 << i;
+			node.child[i] = emit_leaf(cn);
+		}
+		else
+		{
+			node.child[i] = emit(children[i], level + 1);
+		}
+	}
+
+	nodes[index] = node;
+	return index;
+}
+
+// Slab test against all four decoded child boxes, returns a mask of the ones hit.
+int qbvh::child_hits(const qbvh_node& node, const ray_setup& rs, double t_min, double t_max, double* t_near) const
+{
+	double t0[4], t1[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		t0[i] = t_min;
+		t1[i] = t_max;
+	}
+
+	for (int a = 0; a < 3; ++a)
+	{
+		double origin = node.origin[a];
+		double step = power_of_two(node.exponent[a]);
+		for (int i = 0; i < 4; ++i)
+		{
+			double lo = (origin + node.lo[a][i] * step - rs.org[a]) * rs.inv_dir[a];
+			double hi = (origin + node.hi[a][i] * step - rs.org[a]) * rs.inv_dir[a];
+			t0[i] = std::max(t0[i], std::min(lo, hi));
+			t1[i] = std::min(t1[i], std::max(lo, hi));
+		}
+	}
+
+	int mask = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		t_near[i] = t0[i];
+		mask |= ((t0[i] <= t1[i]) & (node.lo[0][i] <= node.hi[0][i])) << i;
+	}
+	return mask;
+}
+
+bool qbvh::hit_leaf(const leaf& l, const ray& r, const watertight_ray& wr, double t_min, double& closest, hit_record& rec) const
+{
+	if (l.packet >= 0)
+	{
+		double t;
+		const triangle4& p = packets[l.packet];
+		int lane = p.intersect(wr, t_min, closest, t);
+		if (lane < 0)
+		{
+			return false;
+		}
+		p.tris[lane]->fill_record(r, t, rec);
+		closest = t;
+		return true;
+	}
+
+	bool hit_anything = false;
+	for (uint32_t i = 0; i < l.count; ++i)
+	{
+		if (prims[l.first + i]->hit(r, t_min, closest, rec))
+		{
+			hit_anything = true;
+			closest = rec.t;
+		}
+	}
+	return hit_anything;
+}
+
+bool qbvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	ray_setup rs;
+	for (int a = 0; a < 3; ++a)
+	{
+		rs.org[a] = r.origin()[a];
+		rs.inv_dir[a] = 1.0 / r.direction()[a];
+	}
+	watertight_ray wr(r);
+
+	struct entry { uint32_t node; double t; };
+	entry stack[max_stack];
+	int top = 0;
+	stack[top++] = entry{0, t_min};
+
+	bool hit_anything = false;
+	double closest = t_max;
+	while (top > 0)
+	{
+		entry e = stack[--top];
+		if (e.t > closest)
+		{
+			continue;
+		}
+
+		const qbvh_node& node = nodes[e.node];
+		double t_near[4];
+		int mask = child_hits(node, rs, t_min, closest, t_near);
+
+		// Leaves are tested right away, interior children pushed far first so the
+		// nearest is popped next.
+		entry pending[4];
+		int count = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)))
+			{
+				continue;
+			}
+			if (node.leaf_mask & (1 << i))
+			{
+				hit_anything |= hit_leaf(leaves[node.child[i]], r, wr, t_min, closest, rec);
+			}
+			else
+			{
+				pending[count++] = entry{node.child[i], t_near[i]};
+			}
+		}
+		for (int i = 1; i < count; ++i)
+		{
+			for (int k = i; k > 0 && pending[k-1].t < pending[k].t; --k)
+			{
+				std::swap(pending[k-1], pending[k]);
+			}
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			stack[top++] = pending[i];
+		}
+	}
+
+	return hit_anything;
+}
+
+bool qbvh::occluded(const ray& r, double t_min, double t_max) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	ray_setup rs;
+	for (int a = 0; a < 3; ++a)
+	{
+		rs.org[a] = r.origin()[a];
+		rs.inv_dir[a] = 1.0 / r.direction()[a];
+	}
+	watertight_ray wr(r);
+
+	uint32_t stack[max_stack];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const qbvh_node& node = nodes[stack[--top]];
+		double t_near[4];
+		int mask = child_hits(node, rs, t_min, t_max, t_near);
+
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)))
+			{
+				continue;
+			}
+			if (!(node.leaf_mask & (1 << i)))
+			{
+				stack[top++] = node.child[i];
+				continue;
+			}
+
+			const leaf& l = leaves[node.child[i]];
+			if (l.packet >= 0)
+			{
+				double t;
+				if (packets[l.packet].intersect(wr, t_min, t_max, t) >= 0)
+				{
+					return true;
+				}
+				continue;
+			}
+			for (uint32_t k = 0; k < l.count; ++k)
+			{
+				if (prims[l.first + k]->occluded(r, t_min, t_max))
+				{
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+const uint32_t leaf_entry = 0x80000000u;	// marks a stream stack entry as a leaf
+
+// Prefetches what a stream stack entry will touch, a node or a leaf's triangle packet.
+void qbvh::prefetch_entry(uint32_t entry) const
+{
+	if (!(entry & leaf_entry))
+	{
+		prefetch(&nodes[entry]);
+		return;
+	}
+	const leaf& l = leaves[entry & ~leaf_entry];
+	if (l.packet >= 0)
+	{
+		const char* p = reinterpret_cast<const char*>(&packets[l.packet]);
+		for (size_t offset = 0; offset < sizeof(triangle4); offset += 64)
+		{
+			prefetch(p + offset);
+		}
+	}
+}
+
+//!	function to find the closest hits of a batch of rays with their memory stalls overlapped.
+/*!
+	Keeps stream_lanes rays in flight, each a small state machine with its own stack. A ray
+	advances by one node or one leaf, then the node or triangle packet it will need next
+	is prefetched and the next ray takes its turn, so by the time a ray comes round again
+	its data has had the other lanes' work to arrive in cache. Leaves go on the stack like
+	nodes for that reason instead of being tested as soon as they are found. A lane whose
+	ray finishes starts the next ray of the batch.
+*/
+void qbvh::hit_stream(const ray* rays, size_t count, double t_min, double t_max, hit_record* recs, bool* hits) const
+{
+	struct entry { uint32_t index; double t; };
+	struct lane
+	{
+		size_t ray;
+		ray_setup rs;
+		watertight_ray wr;
+		double closest;
+		int top;
+		entry stack[max_stack];
+	};
+
+	const size_t none = static_cast<size_t>(-1);
+	const int width = std::max(1, std::min(stream_lanes, static_cast<int>(max_stream_lanes)));
+	lane lanes[max_stream_lanes];
+	size_t next = 0;
+	int active = 0;
+
+	auto start = [&](lane& s)
+	{
+		if (next >= count || nodes.empty())
+		{
+			for (; next < count; ++next)
+			{
+				hits[next] = false;
+			}
+			s.ray = none;
+			return false;
+		}
+		s.ray = next++;
+		const ray& r = rays[s.ray];
+		for (int a = 0; a < 3; ++a)
+		{
+			s.rs.org[a] = r.origin()[a];
+			s.rs.inv_dir[a] = 1.0 / r.direction()[a];
+		}
+		s.wr = watertight_ray(r);
+		s.closest = t_max;
+		s.top = 0;
+		s.stack[s.top++] = entry{0, t_min};
+		hits[s.ray] = false;
+		return true;
+	};
+
+	for (int i = 0; i < width; ++i)
+	{
+		active += start(lanes[i]);
+	}
+
+	for (int i = 0; active > 0; i = i + 1 == width ? 0 : i + 1)
+	{
+		lane& s = lanes[i];
+		if (s.ray == none)
+		{
+			continue;
+		}
+
+		// Skip what the closest hit so far has culled, those cost no memory.
+		while (s.top > 0 && s.stack[s.top - 1].t > s.closest)
+		{
+			--s.top;
+		}
+		if (s.top > 0)
+		{
+			entry e = s.stack[--s.top];
+			if (e.index & leaf_entry)
+			{
+				hits[s.ray] |= hit_leaf(leaves[e.index & ~leaf_entry], rays[s.ray], s.wr, t_min, s.closest, recs[s.ray]);
+			}
+			else
+			{
+				const qbvh_node& node = nodes[e.index];
+				double t_near[4];
+				int mask = child_hits(node, s.rs, t_min, s.closest, t_near);
+
+				entry pending[4];
+				int n = 0;
+				for (int c = 0; c < 4; ++c)
+				{
+					if (mask & (1 << c))
+					{
+						pending[n++] = entry{node.child[c] | ((node.leaf_mask & (1 << c)) ? leaf_entry : 0), t_near[c]};
+					}
+				}
+				for (int c = 1; c < n; ++c)
+				{
+					for (int k = c; k > 0 && pending[k-1].t < pending[k].t; --k)
+					{
+						std::swap(pending[k-1], pending[k]);
+					}
+				}
+				for (int c = 0; c < n; ++c)
+				{
+					s.stack[s.top++] = pending[c];
+				}
+			}
+		}
+
+		if (s.top > 0)
+		{
+			if (stream_prefetch)
+			{
+				prefetch_entry(s.stack[s.top - 1].index);
+			}
+		}
+		else if (!start(s))
+		{
+			--active;
+		}
+	}
+}
+
+//!	function to wrap a scene in an acceleration structure.
+/*!
+	\param world hittable_list& the scene.
+	\param accel std::string& "qbvh" (default), "bvh" for the uncompressed binary tree, or "none".
+	\return shared_ptr<const hittable> what to render, the list itself for "none".
+*/
+std::shared_ptr<const hittable> accelerate(const std::shared_ptr<hittable_list>& world, const std::string& accel = "qbvh")
+{
+	if (!world || world->objects.empty() || accel == "none")
+	{
+		return world;
+	}
+	if (accel == "bvh")
+	{
+		return std::make_shared<bvh_node>(*world);
+	}
+	return std::make_shared<qbvh>(*world);
+}
+
+#endif
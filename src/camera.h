@@ -46,8 +46,14 @@ typedef struct camera
 
 	ray get_ray(double s, double t) const
 	{
-		vec3 rd = lens_radius * random_in_unit_disk();
-		vec3 offset = u * rd.x() + v * rd.y();
+		vec3 rd = random_in_unit_disk();
+		return get_ray(s, t, rd.x(), rd.y());
+	}
+
+	//!	function to return the ray through (s, t) from a given point of the unit disk on the lens.
+	ray get_ray(double s, double t, double lens_x, double lens_y) const
+	{
+		vec3 offset = lens_radius * (u * lens_x + v * lens_y);
 
 		return ray(origin + offset, lower_left_corner + s*horizontal + t*vertical - origin - offset);
 	}
@@ -0,0 +1,492 @@
+#ifndef CONVERGENCE_H
+#define CONVERGENCE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//!	error_metrics struct.
+typedef struct error_metrics
+{
+	double rmse = 0;	// root mean squared error of linear RGB
+	double relmse = 0;	// squared error over the squared reference plus 0.01, averaged
+	double flip = 0;	// mean perceptual color difference in [0,1], see flip_color_error
+} error_metrics;
+
+// Linear RGB to CIE L*a*b*, through XYZ with the sRGB primaries and a D65 white point.
+inline vec3 linear_rgb_to_lab(const color& c)
+{
+	double x = 0.4124*c.x() + 0.3576*c.y() + 0.1805*c.z();
+	double y = 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+	double z = 0.0193*c.x() + 0.1192*c.y() + 0.9505*c.z();
+
+	auto f = [](double t)
+	{
+		return t > 0.008856 ? std::cbrt(t) : 7.787*t + 16.0/116.0;
+	};
+	double fx = f(x / 0.9505), fy = f(y), fz = f(z / 1.089);
+	return vec3(116*fy - 16, 500*(fx - fy), 200*(fy - fz));
+}
+
+//!	function for the color half of NVIDIA's FLIP metric.
+/*!
+	Both images are clamped to [0,1], blurred with a small Gaussian standing in for the
+	contrast sensitivity filter, and compared per pixel with the HyAB distance in L*a*b*,
+	normalized and compressed the way FLIP does it. The edge and point feature half of
+	FLIP is left out, so this tracks color and noise differences but not lost detail.
+	\return double mean error in [0,1].
+*/
+double flip_color_error(const std::vector<color>& test, const std::vector<color>& reference, int width, int height)
+{
+	const double weights[5] = {0.0625, 0.25, 0.375, 0.25, 0.0625};
+
+	auto blur = [&](const std::vector<color>& src)
+	{
+		std::vector<color> tmp(src.size()), out(src.size());
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				color sum(0, 0, 0);
+				for (int k = -2; k <= 2; ++k)
+				{
+					int xx = std::min(width - 1, std::max(0, x + k));
+					const color& c = src[y * width + xx];
+					sum += weights[k + 2] * color(clamp(c.x(), 0, 1), clamp(c.y(), 0, 1), clamp(c.z(), 0, 1));
+				}
+				tmp[y * width + x] = sum;
+			}
+		}
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				color sum(0, 0, 0);
+				for (int k = -2; k <= 2; ++k)
+				{
+					int yy = std::min(height - 1, std::max(0, y + k));
+					sum += weights[k + 2] * tmp[yy * width + x];
+				}
+				out[y * width + x] = sum;
+			}
+		}
+		return out;
+	};
+
+	auto a = blur(test);
+	auto b = blur(reference);
+
+	// HyAB distance between pure green and blue, FLIP's largest possible difference.
+	auto hyab = [](const vec3& p, const vec3& q)
+	{
+		return std::fabs(p.x() - q.x()) + std::sqrt((p.y() - q.y())*(p.y() - q.y()) + (p.z() - q.z())*(p.z() - q.z()));
+	};
+	const double max_distance = std::pow(hyab(linear_rgb_to_lab(color(0, 1, 0)), linear_rgb_to_lab(color(0, 0, 1))), 0.7);
+
+	double total = 0;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		double d = std::pow(hyab(linear_rgb_to_lab(a[i]), linear_rgb_to_lab(b[i])), 0.7);
+		// FLIP's compression, errors past 40% of the range saturate quickly.
+		const double pc = 0.4, pt = 0.95;
+		double n = d / max_distance;
+		total += n < pc ? n * pt / pc : pt + (n - pc) / (1 - pc) * (1 - pt);
+	}
+	return total / a.size();
+}
+
+//!	function to compare an image against a reference.
+error_metrics compare_images(const std::vector<color>& test, const std::vector<color>& reference, int width, int height)
+{
+	error_metrics m;
+	double se = 0, rel = 0;
+	for (size_t i = 0; i < test.size(); ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			double d = test[i][c] - reference[i][c];
+			se += d * d;
+			rel += d * d / (reference[i][c] * reference[i][c] + 0.01);
+		}
+	}
+	double n = 3.0 * test.size();
+	m.rmse = std::sqrt(se / n);
+	m.relmse = rel / n;
+	m.flip = flip_color_error(test, reference, width, height);
+	return m;
+}
+
+//!	convergence_candidate struct.
+/*!
+	One renderer configuration to measure. Parsed from "name:key=value,key=value", with
+	keys depth (bounce limit), accel (qbvh, bvh or none) and guide (path guide training
+	passes, 0 for none).
+*/
+typedef struct convergence_candidate
+{
+	std::string name = "baseline";
+	int max_depth = 50;
+	std::string accel = "qbvh";
+	int guide_passes = 0;
+
+	bool parse(const std::string& spec);
+} convergence_candidate;
+
+bool convergence_candidate::parse(const std::string& spec)
+{
+	auto colon = spec.find(':');
+	name = spec.substr(0, colon);
+	if (name.empty())
+	{
+		return false;
+	}
+	if (colon == std::string::npos)
+	{
+		return true;
+	}
+
+	std::stringstream in(spec.substr(colon + 1));
+	std::string pair;
+	while (std::getline(in, pair, ','))
+	{
+		auto eq = pair.find('=');
+		if (eq == std::string::npos)
+		{
+			return false;
+		}
+		std::string k = pair.substr(0, eq), v = pair.substr(eq + 1);
+		if (k == "depth")
+		{
+			max_depth = std::atoi(v.c_str());
+		}
+		else if (k == "accel" && (v == "qbvh" || v == "bvh" || v == "none"))
+		{
+			accel = v;
+		}
+		else if (k == "guide")
+		{
+			guide_passes = std::atoi(v.c_str());
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return max_depth > 0 && guide_passes >= 0;
+}
+
+//!	convergence_sample struct, one point on a candidate's error over time curve.
+typedef struct convergence_sample
+{
+	std::string scene;
+	std::string candidate;
+	double seconds;
+	int samples_per_pixel;
+	error_metrics error;
+} convergence_sample;
+
+//!	convergence_harness struct.
+/*!
+	Measures how fast renderer configurations approach the right answer. Each scene gets a
+	high spp reference rendered once and cached on disk, keyed by scene, resolution, spp,
+	bounce limit and camera. The reference never uses a radiance cache or path guide, so
+	those are cleared from the settings, the candidates start from the same plain ones.
+	Every candidate then renders the scene progressively, one sample per pixel per pass,
+	and its error against the reference is recorded after each pass until time_budget
+	runs out. The headline number is time to equal quality, the time each candidate needs
+	to get as close as the first candidate does by the end of its budget.
+*/
+typedef struct convergence_harness
+{
+	thread_pool& pool;
+	camera cam;
+	render_settings settings;	// resolution and reference spp
+	std::string reference_dir;
+	double time_budget = 10;
+
+	std::vector<convergence_sample> samples;
+
+	convergence_harness(thread_pool& p, const camera& c, const render_settings& s, const std::string& dir) : pool(p), cam(c), settings(s), reference_dir(dir)
+	{
+		settings.cache.reset();
+		settings.guide.reset();
+	}
+
+	std::vector<color> reference(const std::string& scene);
+	void run(const std::string& scene, const std::vector<convergence_candidate>& candidates);
+	bool write_csv(const std::string& path) const;
+	bool write_json(const std::string& path) const;
+
+	private:
+	// What a cached reference was rendered with, written ahead of the pixels and checked
+	// when it is loaded again.
+	typedef struct reference_header
+	{
+		char magic[8];
+		int32_t width, height, samples_per_pixel, max_depth;
+		double view[13];	// camera origin, lower left corner, spans and lens radius
+	} reference_header;
+
+	reference_header make_header() const;
+	void accumulate(const hittable& world, int max_depth, std::shared_ptr<path_guide> guide, std::vector<color>& sum);
+} convergence_harness;
+
+convergence_harness::reference_header convergence_harness::make_header() const
+{
+	reference_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, "RTREF\0\0\1", sizeof(header.magic));
+	header.width = settings.image_width;
+	header.height = settings.image_height;
+	header.samples_per_pixel = settings.samples_per_pixel;
+	header.max_depth = settings.max_depth;
+	const vec3* view[4] = {&cam.origin, &cam.lower_left_corner, &cam.horizontal, &cam.vertical};
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			header.view[3*i + k] = (*view[i])[k];
+		}
+	}
+	header.view[12] = cam.lens_radius;
+	return header;
+}
+
+// Adds one sample per pixel of the whole frame to sum, spread over the pool.
+void convergence_harness::accumulate(const hittable& world, int max_depth, std::shared_ptr<path_guide> guide, std::vector<color>& sum)
+{
+	render_settings pass = settings;
+	pass.samples_per_pixel = 1;
+	pass.max_depth = max_depth;
+	pass.guide = guide;
+	std::atomic<int> next_row(0);
+
+	pool.parallel([&]()
+	{
+		std::vector<color> pixels;
+		for (int row = next_row++; row < pass.image_height; row = next_row++)
+		{
+			render_row(cam, world, pass, row, pixels);
+			for (int i = 0; i < pass.image_width; ++i)
+			{
+				sum[row * pass.image_width + i] += pixels[i];
+			}
+		}
+	});
+}
+
+//!	function to load the reference for a scene, rendering and caching it first if needed.
+/*!
+	\return std::vector<color> averaged linear colors, row 0 at the top.
+*/
+std::vector<color> convergence_harness::reference(const std::string& scene)
+{
+	const int w = settings.image_width, h = settings.image_height;
+	reference_header header = make_header();
+
+	// The name carries a hash of the whole header so references for several views or
+	// depths can sit side by side, the header itself guards against collisions.
+	uint64_t hash = 0;
+	uint64_t words[sizeof(header) / sizeof(uint64_t)];
+	std::memcpy(words, &header, sizeof(words));
+	for (auto word : words)
+	{
+		hash = splitmix64(hash ^ word);
+	}
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+	std::string path = reference_dir + "/reference_" + scene + '_' + std::to_string(w) + 'x' + std::to_string(h) + '_' + std::to_string(settings.samples_per_pixel) + '_' + hex + ".bin";
+
+	std::vector<color> image(w * h);
+	reference_header stored;
+	std::ifstream cached(path, std::ios::binary);
+	if (cached.read(reinterpret_cast<char*>(&stored), sizeof(stored)) && std::memcmp(&stored, &header, sizeof(header)) == 0
+	    && cached.read(reinterpret_cast<char*>(image.data()), image.size() * sizeof(color)))
+	{
+		return image;
+	}
+
+	std::cerr << "Rendering " << settings.samples_per_pixel << " spp reference for " << scene << '\n';
+	auto world = accelerate(build_scene(scene));
+	auto sink = std::make_shared<image_sink>();
+	render_job::launch(pool, world, cam, settings, sink)->wait();
+
+	std::ofstream out(path, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(sink->pixels.data()), sink->pixels.size() * sizeof(color));
+	return sink->pixels;
+}
+
+//!	function to measure every candidate on one scene.
+void convergence_harness::run(const std::string& scene, const std::vector<convergence_candidate>& candidates)
+{
+	const int w = settings.image_width, h = settings.image_height;
+	auto ref = reference(scene);
+
+	for (const auto& candidate : candidates)
+	{
+		std::cerr << "Measuring " << candidate.name << " on " << scene << '\n';
+		// Building the acceleration structure and training the guide count, scoring the image does not.
+		auto build_start = std::chrono::steady_clock::now();
+		auto world = accelerate(build_scene(scene), candidate.accel);
+		std::shared_ptr<path_guide> guide;
+		if (candidate.guide_passes > 0)
+		{
+			render_settings training = settings;
+			training.max_depth = candidate.max_depth;
+			training.guide = guide = std::make_shared<path_guide>(1.0);
+			train_guide(pool, world, cam, training, candidate.guide_passes);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+
+		std::vector<color> sum(w * h, color(0, 0, 0)), image(w * h);
+		int spp = 0;
+		do
+		{
+			auto pass_start = std::chrono::steady_clock::now();
+			accumulate(*world, candidate.max_depth, guide, sum);
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - pass_start).count();
+			++spp;
+
+			for (size_t i = 0; i < sum.size(); ++i)
+			{
+				image[i] = sum[i] / spp;
+			}
+			samples.push_back(convergence_sample{scene, candidate.name, seconds, spp, compare_images(image, ref, w, h)});
+		} while (seconds < time_budget);
+	}
+}
+
+// Names come from --candidate, so they are escaped before going into a report, as a JSON
+// string here and as a CSV field, quoted only when it holds a separator, below.
+inline std::string json_string(const std::string& text)
+{
+	std::string quoted = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			quoted += '\\';
+			quoted += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escape[8];
+			std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned char>(c));
+			quoted += escape;
+		}
+		else
+		{
+			quoted += c;
+		}
+	}
+	return quoted + '"';
+}
+
+inline std::string csv_field(const std::string& text)
+{
+	if (text.find_first_of(",\"\r\n") == std::string::npos)
+	{
+		return text;
+	}
+	std::string quoted = "\"";
+	for (char c : text)
+	{
+		quoted += c;
+		if (c == '"')
+		{
+			quoted += c;
+		}
+	}
+	return quoted + '"';
+}
+
+bool convergence_harness::write_csv(const std::string& path) const
+{
+	std::ofstream out(path);
+	out << "scene,candidate,seconds,spp,rmse,relmse,flip\n";
+	for (const auto& s : samples)
+	{
+		out << csv_field(s.scene) << ',' << csv_field(s.candidate) << ',' << s.seconds << ',' << s.samples_per_pixel << ','
+		    << s.error.rmse << ',' << s.error.relmse << ',' << s.error.flip << '\n';
+	}
+	return out.good();
+}
+
+//!	function to write every curve plus the time to equal quality summary as JSON.
+bool convergence_harness::write_json(const std::string& path) const
+{
+	std::ofstream out(path);
+	out << "{\n  \"samples\": [\n";
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		const auto& s = samples[i];
+		out << "    {\"scene\": " << json_string(s.scene) << ", \"candidate\": " << json_string(s.candidate) << ", \"seconds\": " << s.seconds
+		    << ", \"spp\": " << s.samples_per_pixel << ", \"rmse\": " << s.error.rmse << ", \"relmse\": " << s.error.relmse
+		    << ", \"flip\": " << s.error.flip << '}' << (i + 1 < samples.size() ? "," : "") << '\n';
+	}
+	out << "  ],\n  \"time_to_equal_quality\": [\n";
+
+	// The first candidate measured on a scene is the baseline, its final relMSE is the target.
+	bool first_entry = true;
+	for (size_t i = 0; i < samples.size(); )
+	{
+		const std::string& scene = samples[i].scene;
+		const std::string& baseline = samples[i].candidate;
+		size_t end = i;
+		while (end < samples.size() && samples[end].scene == scene)
+		{
+			++end;
+		}
+		double target = 0;
+		for (size_t k = i; k < end && samples[k].candidate == baseline; ++k)
+		{
+			target = samples[k].error.relmse;
+		}
+
+		for (size_t k = i; k < end; )
+		{
+			const std::string& name = samples[k].candidate;
+			double reached = -1;
+			for (; k < end && samples[k].candidate == name; ++k)
+			{
+				if (reached < 0 && samples[k].error.relmse <= target)
+				{
+					reached = samples[k].seconds;
+				}
+			}
+			out << (first_entry ? "" : ",\n") << "    {\"scene\": " << json_string(scene) << ", \"candidate\": " << json_string(name)
+			    << ", \"target_relmse\": " << target << ", \"seconds\": ";
+			if (reached < 0)
+			{
+				out << "null";
+			}
+			else
+			{
+				out << reached;
+			}
+			out << '}';
+			first_entry = false;
+		}
+		i = end;
+	}
+	out << "\n  ]\n}\n";
+	return out.good();
+}
+
+#endif
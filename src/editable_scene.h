@@ -0,0 +1,263 @@
+#ifndef EDITABLE_SCENE_H
+#define EDITABLE_SCENE_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//!	scene_edit struct.
+/*!
+	One change made through editable_scene::replace(), as handed out by take_edits().
+*/
+typedef struct scene_edit
+{
+	uint32_t object;	// index of the object that changed
+	aabb after;		// its box after the change
+	bool moved;		// false if the box stayed the same, for a material change
+} scene_edit;
+
+//!	editable_scene struct.
+/*!
+	A scene whose objects can be swapped out between frames. It keeps its own binary
+	bounding volume hierarchy with one object per leaf and parent links, so replace()
+	only refits the boxes from the changed leaf up to the root instead of rebuilding.
+	Refitting never re-splits, a tree that has seen many large moves traverses slower
+	than a fresh build.
+
+	hit_object() also reports which object a ray hit, which is how the incremental
+	renderer learns what each tile depends on. Every change is logged until take_edits()
+	collects it. Edits must not run while a frame is being rendered.
+*/
+typedef struct editable_scene : hittable
+{
+	static const uint32_t no_object = 0xffffffffu;
+	// A walk holds at most depth + 1 entries, median splits keep depth at most 33 for
+	// 2^32 objects and refitting never changes it.
+	static const int max_stack = 64;
+
+	int depth = 0;	// node levels, the root being 1
+
+	editable_scene(const hittable_list& list);
+
+	size_t size() const
+	{
+		return objects.size();
+	}
+	const std::shared_ptr<hittable>& object(size_t index) const
+	{
+		return objects[index];
+	}
+
+	void replace(uint32_t index, std::shared_ptr<hittable> object);
+	std::vector<scene_edit> take_edits();
+
+	bool hit_object(const ray& r, double t_min, double t_max, hit_record& rec, uint32_t& object) const;
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override
+	{
+		uint32_t object;
+		return hit_object(r, t_min, t_max, rec, object);
+	}
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		output_box = nodes.empty() ? aabb() : nodes[0].box;
+		return !nodes.empty();
+	}
+
+	private:
+	typedef struct node
+	{
+		aabb box;
+		uint32_t parent;	// the root is its own parent
+		uint32_t left;		// children, unused in a leaf
+		uint32_t right;
+		uint32_t object;	// no_object for an interior node
+	} node;
+
+	std::vector<std::shared_ptr<hittable>> objects;
+	std::vector<node> nodes;		// nodes[0] is the root
+	std::vector<uint32_t> leaf_of;		// leaf node of every object
+	std::vector<scene_edit> edits;
+
+	uint32_t build(std::vector<uint32_t>& order, size_t start, size_t end, uint32_t parent, int level);
+} editable_scene;
+
+editable_scene::editable_scene(const hittable_list& list) : objects(list.objects)
+{
+	if (objects.empty())
+	{
+		return;
+	}
+	std::vector<uint32_t> order(objects.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = static_cast<uint32_t>(i);
+	}
+	leaf_of.resize(objects.size());
+	nodes.reserve(2 * objects.size());
+	build(order, 0, order.size(), 0, 1);
+	assert(depth + 1 <= max_stack);
+}
+
+// Centroid median split on the longest axis, depth first so the root lands at 0.
+uint32_t editable_scene::build(std::vector<uint32_t>& order, size_t start, size_t end, uint32_t parent, int level)
+{
+	depth = std::max(depth, level);
+	uint32_t self = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(node{aabb(), parent, 0, 0, no_object});
+
+	if (end - start == 1)
+	{
+		uint32_t index = order[start];
+		objects[index]->bounding_box(nodes[self].box);
+		nodes[self].object = index;
+		leaf_of[index] = self;
+		return self;
+	}
+
+	aabb centroids;
+	for (size_t i = start; i < end; ++i)
+	{
+		aabb box;
+		objects[order[i]]->bounding_box(box);
+		auto c = box.centroid();
+		centroids = surrounding_box(centroids, aabb(c, c));
+	}
+	int axis = centroids.longest_axis();
+	size_t mid = start + (end - start) / 2;
+	std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b)
+	{
+		aabb box_a, box_b;
+		objects[a]->bounding_box(box_a);
+		objects[b]->bounding_box(box_b);
+		return box_a.centroid()[axis] < box_b.centroid()[axis];
+	});
+
+	uint32_t left = build(order, start, mid, self, level + 1);
+	uint32_t right = build(order, mid, end, self, level + 1);
+	nodes[self].left = left;
+	nodes[self].right = right;
+	nodes[self].box = surrounding_box(nodes[left].box, nodes[right].box);
+	return self;
+}
+
+//!	function to swap one object for another and refit the tree above it.
+/*!
+	Moving an object or changing its material both go through here, with a new object
+	built from the old one. The change is logged for take_edits().
+	\param index uint32_t the object to replace.
+	\param object shared_ptr<hittable> what takes its place.
+*/
+void editable_scene::replace(uint32_t index, std::shared_ptr<hittable> object)
+{
+	aabb before = nodes[leaf_of[index]].box;
+	aabb after;
+	object->bounding_box(after);
+	objects[index] = object;
+
+	uint32_t n = leaf_of[index];
+	nodes[n].box = after;
+	while (n != 0)
+	{
+		n = nodes[n].parent;
+		nodes[n].box = surrounding_box(nodes[nodes[n].left].box, nodes[nodes[n].right].box);
+	}
+
+	bool moved = false;
+	for (int a = 0; a < 3; ++a)
+	{
+		moved |= before.min()[a] != after.min()[a] || before.max()[a] != after.max()[a];
+	}
+	edits.push_back(scene_edit{index, after, moved});
+}
+
+//!	function to hand out and forget the changes made since the last call.
+std::vector<scene_edit> editable_scene::take_edits()
+{
+	std::vector<scene_edit> taken;
+	taken.swap(edits);
+	return taken;
+}
+
+//!	function for the closest hit that also tells which object was hit.
+/*!
+	\param object uint32_t& receives the index of the object hit, untouched on a miss.
+	\return bool true if anything was hit inside [t_min, t_max].
+*/
+bool editable_scene::hit_object(const ray& r, double t_min, double t_max, hit_record& rec, uint32_t& object) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	uint32_t stack[max_stack];
+	int top = 0;
+	stack[top++] = 0;
+
+	bool hit_anything = false;
+	double closest = t_max;
+	while (top > 0)
+	{
+		const node& n = nodes[stack[--top]];
+		if (!n.box.hit(r, t_min, closest))
+		{
+			continue;
+		}
+		if (n.object != no_object)
+		{
+			if (objects[n.object]->hit(r, t_min, closest, rec))
+			{
+				hit_anything = true;
+				closest = rec.t;
+				object = n.object;
+			}
+			continue;
+		}
+		stack[top++] = n.right;
+		stack[top++] = n.left;
+	}
+	return hit_anything;
+}
+
+bool editable_scene::occluded(const ray& r, double t_min, double t_max) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+
+	uint32_t stack[max_stack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const node& n = nodes[stack[--top]];
+		if (!n.box.hit(r, t_min, t_max))
+		{
+			continue;
+		}
+		if (n.object != no_object)
+		{
+			if (objects[n.object]->occluded(r, t_min, t_max))
+			{
+				return true;
+			}
+			continue;
+		}
+		stack[top++] = n.right;
+		stack[top++] = n.left;
+	}
+	return false;
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
 #include "ray.h"
 
 struct material;
@@ -23,6 +24,19 @@ struct hit_record
 typedef struct hittable
 {
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+	// Any-hit query for shadow and visibility rays, true as soon as anything is found in
+	// [t_min, t_max]. Fills no record, so it never has to find the closest hit.
+	virtual bool occluded(const ray& r, double t_min, double t_max) const = 0;
+	virtual bool bounding_box(aabb& output_box) const = 0;
+	// Closest hits for a batch of rays, hits[i] tells whether recs[i] was filled. Structures
+	// that can overlap the memory stalls of independent rays override it.
+	virtual void hit_stream(const ray* rays, size_t count, double t_min, double t_max, hit_record* recs, bool* hits) const
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			hits[i] = hit(rays[i], t_min, t_max, recs[i]);
+		}
+	}
 } hittable;
 
 #endif
@@ -26,6 +26,8 @@ typedef struct hittable_list : hittable
 	}
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
 } hittable_list;
 
 bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
@@ -47,4 +49,38 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 	return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, double t_min, double t_max) const
+{
+	for (const auto& object : objects)
+	{
+		if (object->occluded(r, t_min, t_max))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool hittable_list::bounding_box(aabb& output_box) const
+{
+	if (objects.empty())
+	{
+		return false;
+	}
+
+	aabb temp_box;
+	output_box = aabb();
+	for (const auto& object : objects)
+	{
+		if (!object->bounding_box(temp_box))
+		{
+			return false;
+		}
+		output_box = surrounding_box(output_box, temp_box);
+	}
+
+	return true;
+}
+
 #endif
@@ -0,0 +1,244 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "editable_scene.h"
+#include "hittable.h"
+#include "output_sink.h"
+#include "renderer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+//!	traced_segment struct.
+typedef struct traced_segment
+{
+	ray r;
+	double t_end;	// where the ray stopped, infinity if it left the scene
+} traced_segment;
+
+//!	tile_record struct.
+/*!
+	What one tile of the last frame depended on: every object its camera rays and their
+	first bounces hit, over all samples, and the camera ray and first bounce of the first
+	sample of each pixel as segments. The objects catch edits to anything the tile saw,
+	the segments catch an object moving into a path that used to be clear, such as a new
+	shadow falling on the tile.
+*/
+typedef struct tile_record
+{
+	int x0, y0, x1, y1;	// pixel rectangle, rows counted from the top
+	std::vector<uint32_t> objects;	// sorted
+	std::vector<traced_segment> segments;
+	bool dirty = true;
+
+	bool affected_by(const scene_edit& edit) const;
+} tile_record;
+
+//!	function to decide whether an edit can change what the tile shows.
+bool tile_record::affected_by(const scene_edit& edit) const
+{
+	if (std::binary_search(objects.begin(), objects.end(), edit.object))
+	{
+		return true;
+	}
+	if (!edit.moved)
+	{
+		return false;
+	}
+	for (const auto& s : segments)
+	{
+		if (edit.after.hit(s.r, 0.001, s.t_end))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//!	tile_recorder struct.
+/*!
+	Stands in for the scene while a tile renders and logs the first two closest hit
+	queries of every sample into the tile's record. ray_color() traces depth first, so
+	those two are the camera ray and its first bounce. The renderer sets remaining before
+	each sample.
+*/
+typedef struct tile_recorder : hittable
+{
+	const editable_scene& scene;
+	tile_record& record;
+	mutable int remaining = 0;	// queries still to log in this sample
+	bool keep_segments = false;
+
+	tile_recorder(const editable_scene& s, tile_record& t) : scene(s), record(t) {}
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override
+	{
+		uint32_t object = editable_scene::no_object;
+		bool found = scene.hit_object(r, t_min, t_max, rec, object);
+		if (remaining > 0)
+		{
+			--remaining;
+			if (found && (record.objects.empty() || record.objects.back() != object))
+			{
+				record.objects.push_back(object);
+			}
+			if (keep_segments)
+			{
+				record.segments.push_back(traced_segment{r, found ? rec.t : infinity});
+			}
+		}
+		return found;
+	}
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override
+	{
+		return scene.occluded(r, t_min, t_max);
+	}
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		return scene.bounding_box(output_box);
+	}
+} tile_recorder;
+
+//!	incremental_renderer struct.
+/*!
+	Renders an editable_scene in tiles and keeps the last frame. After the scene has been
+	edited, render() collects the edits, marks the tiles they can affect going by each
+	tile's record, and re-renders only those, the rest of the frame is kept as it was.
+	A new camera invalidates every tile.
+
+	Only the camera ray and first bounce are tracked, so an edit seen solely through two
+	or more bounces, a sphere reflected in a mirror reflected in another, leaves a stale
+	tile behind. The radiance cache and path guide learned the old scene and are not used.
+*/
+typedef struct incremental_renderer
+{
+	thread_pool& pool;
+	std::shared_ptr<editable_scene> scene;
+	render_settings settings;
+	int tile_size;
+	std::vector<color> pixels;	// averaged linear colors, row major, row 0 is the top
+	std::vector<tile_record> tiles;
+
+	incremental_renderer(thread_pool& p, std::shared_ptr<editable_scene> s, const render_settings& rs, int tile = 16);
+
+	void set_camera(const camera& c);
+	size_t render();
+	void write(output_sink& sink) const;
+
+	private:
+	camera cam;
+
+	void render_tile(tile_record& tile);
+} incremental_renderer;
+
+incremental_renderer::incremental_renderer(thread_pool& p, std::shared_ptr<editable_scene> s, const render_settings& rs, int tile) : pool(p), scene(s), settings(rs), tile_size(tile)
+{
+	pixels.assign(static_cast<size_t>(settings.image_width) * settings.image_height, color(0, 0, 0));
+	for (int y = 0; y < settings.image_height; y += tile_size)
+	{
+		for (int x = 0; x < settings.image_width; x += tile_size)
+		{
+			tile_record t;
+			t.x0 = x;
+			t.y0 = y;
+			t.x1 = std::min(x + tile_size, settings.image_width);
+			t.y1 = std::min(y + tile_size, settings.image_height);
+			tiles.push_back(t);
+		}
+	}
+}
+
+//!	function to point the renderer at a new view, every tile is rendered again.
+void incremental_renderer::set_camera(const camera& c)
+{
+	cam = c;
+	for (auto& t : tiles)
+	{
+		t.dirty = true;
+	}
+}
+
+//!	function to bring the frame up to date with the scene.
+/*!
+	Must not run while the scene is being edited.
+	\return size_t the number of tiles that were rendered again.
+*/
+size_t incremental_renderer::render()
+{
+	for (const auto& edit : scene->take_edits())
+	{
+		for (auto& t : tiles)
+		{
+			t.dirty = t.dirty || t.affected_by(edit);
+		}
+	}
+
+	std::vector<tile_record*> dirty;
+	for (auto& t : tiles)
+	{
+		if (t.dirty)
+		{
+			dirty.push_back(&t);
+		}
+	}
+
+	std::atomic<size_t> next(0);
+	pool.parallel([&]()
+	{
+		for (size_t k = next++; k < dirty.size(); k = next++)
+		{
+			render_tile(*dirty[k]);
+		}
+	});
+	return dirty.size();
+}
+
+void incremental_renderer::render_tile(tile_record& tile)
+{
+	tile.objects.clear();
+	tile.segments.clear();
+	tile_recorder recorder(*scene, tile);
+
+	for (int y = tile.y0; y < tile.y1; ++y)
+	{
+		int j = settings.image_height - 1 - y;
+		for (int i = tile.x0; i < tile.x1; ++i)
+		{
+			color pixel_color(0, 0, 0);
+			for (int s = 0; s < settings.samples_per_pixel; ++s)
+			{
+				auto u = (i + random_double()) / (settings.image_width-1);
+				auto v = (j + random_double()) / (settings.image_height-1);
+				recorder.remaining = 2;
+				recorder.keep_segments = s == 0;
+				pixel_color += ray_color(cam.get_ray(u, v), recorder, settings.max_depth);
+			}
+			pixels[static_cast<size_t>(y) * settings.image_width + i] = pixel_color / settings.samples_per_pixel;
+		}
+	}
+
+	std::sort(tile.objects.begin(), tile.objects.end());
+	tile.objects.erase(std::unique(tile.objects.begin(), tile.objects.end()), tile.objects.end());
+	tile.dirty = false;
+}
+
+//!	function to send the current frame to a sink, one row at a time.
+void incremental_renderer::write(output_sink& sink) const
+{
+	sink.begin(settings.image_width, settings.image_height);
+	std::vector<color> row(settings.image_width);
+	for (int y = 0; y < settings.image_height; ++y)
+	{
+		std::copy(pixels.begin() + static_cast<size_t>(y) * settings.image_width, pixels.begin() + static_cast<size_t>(y + 1) * settings.image_width, row.begin());
+		sink.write_row(y, row, 1);
+	}
+	sink.end();
+}
+
+#endif
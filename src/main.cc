@@ -1,212 +1,773 @@
 #include "rtweekend.h"
 
+#include "bvh.h"
 #include "camera.h"
-#include "color.h"
+#include "convergence.h"
+#include "editable_scene.h"
 #include "hittable_list.h"
+#include "incremental.h"
 #include "material.h"
+#include "numa_scene.h"
+#include "ooc.h"
+#include "output_sink.h"
+#include "preview.h"
+#include "renderer.h"
+#include "sampling.h"
+#include "scenes.h"
+#include "service.h"
 #include "sphere.h"
-#include "triangle.h"
+#include "thread_pool.h"
 
-#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
-#include <sstream>
+#include <functional>
+#include <iostream>
+#include <string>
 #include <thread>
-#include <vector>
 
 enum RES { nHD = 640, qHD = 960, HD = 1280, FHD = 1920, QHD = 2560, UHD = 3840};
 
-//! A function that takes in two arguments, returns a color object.
-/*! 
-  \param r ray&, casted ray for drawing the scene.
-  \param world hittable&, hittable object representing objects in the world.
-  \return The color of the pixel to be drawn in the scene.
- */
-color ray_color(const ray& r, const hittable& world, int depth)
+//!	struct holding everything main() can be told on the command line.
+typedef struct options
+{
+	std::string path = "../data/image.ppm";
+	std::string scene = "cover";
+	std::string accel = "qbvh";
+	int image_width = nHD; // nHD: 640, qHD: 960, HD: 1280, Full HD: 1920, QHD: 2560, 4K UHD: 3840
+	int samples_per_pixel = 500;
+	int max_depth = 50;
+	size_t num_threads = std::thread::hardware_concurrency();
+	pinning pin = PIN_NONE;
+	scene_placement placement = SCENE_FIRST_TOUCH;
+	bool scaling = false;		// time the render from 1 thread up to num_threads instead
+
+	bool converge = false;		// run the quality versus time harness instead
+	std::string report = "../data/convergence";
+	double budget = 10;
+	int reference_spp = 4096;
+	std::vector<convergence_candidate> candidates;
+	bool interactive_preview = false;
+	std::string socket_path;	// serve requests on this Unix socket instead of rendering once
+	std::string ooc_path;		// render from this out-of-core scene file, written first if missing
+	size_t ooc_cache_mb = 256;
+	double cache_spacing = 0;	// radiance cache cell size, 0 traces every path
+	double cache_error = 0.1;
+	bool cache_compare = false;	// time the render with and without the cache
+	bool stream = false;		// breadth first rows through hit_stream()
+	bool sort_rays = false;		// sort the bounces of each stream batch for coherence
+	bool ray_bench = false;		// measure rays per second of the traversal modes instead
+	bool sampler_bench = false;	// measure samples per second of the scalar and batched samplers
+	int guide_passes = 0;		// path guide training passes, 0 renders unguided
+	double guide_spacing = 1;
+	std::string views_path;		// render every camera listed in this file instead of one
+	int edits = 0;			// random sphere edits to re-render incrementally, 0 for none
+
+	point3 lookfrom = point3(13,2,3);
+	point3 lookat = point3(0,0,0);
+	double vfov = 20;
+	double aperture = 0.1;
+	double dist_to_focus = 13.5;
+} options;
+
+void usage()
+{
+	std::cerr << "usage: main [options]\n"
+	          << "  -o <path>            output ppm (../data/image.ppm)\n"
+	          << "  -w <width>           image width, height follows from 16:9 (640)\n"
+	          << "  -s <spp>             samples per pixel (500)\n"
+	          << "  -d <depth>           ray bounce limit (50)\n"
+	          << "  -t <threads>         worker threads (all hardware threads)\n"
+	          << "  --scene <name>       cover, my, mesh or window (cover)\n"
+	          << "  --accel <name>       qbvh, bvh or none (qbvh)\n"
+	          << "  --lookfrom <x,y,z>   camera position (13,2,3)\n"
+	          << "  --lookat <x,y,z>     camera target (0,0,0)\n"
+	          << "  --vfov <degrees>     vertical field of view (20)\n"
+	          << "  --aperture <a>       lens aperture (0.1)\n"
+	          << "  --focus <d>          focus distance (13.5)\n"
+	          << "  --pin <mode>         none, compact or scatter worker pinning (none)\n"
+	          << "  --numa-scene <mode>  first-touch or replicate, replicate builds a copy per NUMA node,\n"
+	          << "                       only useful with pinning, first-touch builds one copy from a\n"
+	          << "                       thread on node 0 (first-touch)\n"
+	          << "  --scaling            report render time from 1 thread up to -t threads\n"
+	          << "  --converge           quality versus time harness on the cover, my, mesh and window scenes,\n"
+	          << "                       writes <report>.json and <report>.csv\n"
+	          << "  --report <prefix>    harness output prefix (../data/convergence)\n"
+	          << "  --budget <seconds>   harness time budget per candidate (10)\n"
+	          << "  --reference-spp <n>  harness reference spp, cached next to the report (4096)\n"
+	          << "  --candidate <spec>   harness candidate as name:depth=n,accel=name, repeatable,\n"
+	          << "                       the first one is the baseline (baseline:depth=50,accel=qbvh),\n"
+	          << "                       guide=<passes> trains a path guide first\n"
+	          << "  --ooc <file>         render from an out-of-core scene file, writes the scene there\n"
+	          << "                       first if the file does not exist yet\n"
+	          << "  --ooc-cache <MB>     memory for paged in geometry (256)\n"
+	          << "  --views <file>       render one image per line of <lookfrom> <lookat> <vfov> <aperture>\n"
+	          << "                       <focus> <output>, all against the same scene build\n"
+	          << "  --edits <n>          render in tiles, then make n random edits to small spheres and\n"
+	          << "                       render again only the tiles each one touches\n"
+	          << "  --radiance-cache <s> cache incoming light at diffuse hits past the first bounce in\n"
+	          << "                       cells s wide (off)\n"
+	          << "  --cache-error <e>    relative standard error a cell must reach before use (0.1)\n"
+	          << "  --cache-compare      render with and without the cache, report speedup and error\n"
+	          << "  --stream             trace each row a bounce at a time, interleaving many rays per\n"
+	          << "                       worker with prefetching in the qbvh\n"
+	          << "  --sort-rays          with --stream, sort every bounce by origin and direction before\n"
+	          << "                       tracing it\n"
+	          << "  --ray-bench          rays per second of one ray at a time against the stream modes,\n"
+	          << "                       on camera rays, bounce rays and bounce rays sorted\n"
+	          << "  --sampler-bench      samples per second of the one at a time samplers against the\n"
+	          << "                       batched ones in sampling.h\n"
+	          << "  --guide <passes>     train a path guide in passes of 1, 2, 4... spp, then render guided\n"
+	          << "  --guide-spacing <s>  path guide cell size (1)\n"
+	          << "  --preview            progressive preview, rewrites the output until enter is pressed\n"
+	          << "  --serve <socket>     run as a render service on a Unix socket\n";
+}
+
+bool parse_vec3(const char* s, vec3& v)
+{
+	return std::sscanf(s, "%lf,%lf,%lf", &v[0], &v[1], &v[2]) == 3;
+}
+
+bool parse_options(int argc, char** argv, options& opt)
 {
-	hit_record rec;
-	
-	// If we've exceeded the ray bounce limit, no more light is gathered.
-	if (depth <= 0)
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		if (std::strcmp(arg, "--preview") == 0)
+		{
+			opt.interactive_preview = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--scaling") == 0)
+		{
+			opt.scaling = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--converge") == 0)
+		{
+			opt.converge = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--cache-compare") == 0)
+		{
+			opt.cache_compare = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--stream") == 0)
+		{
+			opt.stream = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--sort-rays") == 0)
+		{
+			opt.sort_rays = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--sampler-bench") == 0)
+		{
+			opt.sampler_bench = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--ray-bench") == 0)
+		{
+			opt.ray_bench = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			return false;
+		}
+		const char* value = argv[++i];
+
+		if      (std::strcmp(arg, "-o") == 0)		opt.path = value;
+		else if (std::strcmp(arg, "-w") == 0)		opt.image_width = std::atoi(value);
+		else if (std::strcmp(arg, "-s") == 0)		opt.samples_per_pixel = std::atoi(value);
+		else if (std::strcmp(arg, "-d") == 0)		opt.max_depth = std::atoi(value);
+		else if (std::strcmp(arg, "-t") == 0)		opt.num_threads = std::atoi(value);
+		else if (std::strcmp(arg, "--scene") == 0)	opt.scene = value;
+		else if (std::strcmp(arg, "--accel") == 0)	opt.accel = value;
+		else if (std::strcmp(arg, "--serve") == 0)	opt.socket_path = value;
+		else if (std::strcmp(arg, "--vfov") == 0)	opt.vfov = std::atof(value);
+		else if (std::strcmp(arg, "--aperture") == 0)	opt.aperture = std::atof(value);
+		else if (std::strcmp(arg, "--focus") == 0)	opt.dist_to_focus = std::atof(value);
+		else if (std::strcmp(arg, "--radiance-cache") == 0)	opt.cache_spacing = std::atof(value);
+		else if (std::strcmp(arg, "--cache-error") == 0)	opt.cache_error = std::atof(value);
+		else if (std::strcmp(arg, "--guide") == 0)	opt.guide_passes = std::atoi(value);
+		else if (std::strcmp(arg, "--guide-spacing") == 0)	opt.guide_spacing = std::atof(value);
+		else if (std::strcmp(arg, "--views") == 0)	opt.views_path = value;
+		else if (std::strcmp(arg, "--edits") == 0)	opt.edits = std::atoi(value);
+		else if (std::strcmp(arg, "--ooc") == 0)	opt.ooc_path = value;
+		else if (std::strcmp(arg, "--ooc-cache") == 0)	opt.ooc_cache_mb = std::atoi(value);
+		else if (std::strcmp(arg, "--report") == 0)	opt.report = value;
+		else if (std::strcmp(arg, "--budget") == 0)	opt.budget = std::atof(value);
+		else if (std::strcmp(arg, "--reference-spp") == 0)	opt.reference_spp = std::atoi(value);
+		else if (std::strcmp(arg, "--candidate") == 0)
+		{
+			convergence_candidate candidate;
+			if (!candidate.parse(value))
+			{
+				return false;
+			}
+			opt.candidates.push_back(candidate);
+		}
+		else if (std::strcmp(arg, "--pin") == 0)
+		{
+			if      (std::strcmp(value, "none") == 0)		opt.pin = PIN_NONE;
+			else if (std::strcmp(value, "compact") == 0)	opt.pin = PIN_COMPACT;
+			else if (std::strcmp(value, "scatter") == 0)	opt.pin = PIN_SCATTER;
+			else return false;
+		}
+		else if (std::strcmp(arg, "--numa-scene") == 0)
+		{
+			if      (std::strcmp(value, "first-touch") == 0)	opt.placement = SCENE_FIRST_TOUCH;
+			else if (std::strcmp(value, "replicate") == 0)	opt.placement = SCENE_REPLICATE;
+			else return false;
+		}
+		else if (std::strcmp(arg, "--lookfrom") == 0)
+		{
+			if (!parse_vec3(value, opt.lookfrom))
+			{
+				return false;
+			}
+		}
+		else if (std::strcmp(arg, "--lookat") == 0)
+		{
+			if (!parse_vec3(value, opt.lookat))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return opt.image_width > 1 && opt.samples_per_pixel > 0 && opt.max_depth > 0 && known_scene(opt.scene) && (opt.accel == "qbvh" || opt.accel == "bvh" || opt.accel == "none");
+}
+
+int main(int argc, char** argv) {
+	options opt;
+	if (!parse_options(argc, argv, opt))
 	{
-		return color(0,0,0);
+		usage();
+		return(1);
 	}
 
-	if (world.hit(r, 0.001, infinity, rec))
+	// Threads
+	thread_pool pool(opt.num_threads, opt.pin);
+	auto topology = numa_topology::detect();
+
+	// Service
+	if (!opt.socket_path.empty())
 	{
-		// TODO: allow of toggling of different diffuse methods?
-//		point3 target = rec.p + rec.nomral + random_in_unit_sphere();	// Aproximation of Lambertian diffuse
-//		point3 target = rec.p + rec.normal + random_unit_vector();	// Lambertian diffuse
-//		point3 target = rec.p + random_in_hemisphere(rec.normal);	// Hemispherical scattering
-//		return 0.5 * ray_color(ray(rec.p, target - rec.p), world, depth-1);
-		ray scattered;
-		color attenuation;
-		if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+		render_service service(pool);
+		if (!service.serve(opt.socket_path))
 		{
-			return attenuation * ray_color(scattered, world, depth-1);
+			std::cerr << "Could not listen on " << opt.socket_path << '\n';
+			return(1);
 		}
-		return color(0,0,0);
+		return(0);
 	}
-	vec3 unit_direction = unit_vector(r.direction());
-	auto t = 0.5*(unit_direction.y() + 1.0);
-	return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
-//	return (1.0-t)*color(0.5, 0.7, 1.0) + t*color(0, 0, 0);
-}
 
-hittable_list cover_scene()
-{
-	hittable_list world;
+	// Sampler benchmark
+	if (opt.sampler_bench)
+	{
+		// The sums only keep the compiler from dropping the samples.
+		const int n = 1 << 16;
+		std::vector<double> x(n), y(n), z(n);
+		volatile double sink = 0;
+		auto measure = [&](const char* sampler, const char* mode, std::function<void()> pass)
+		{
+			size_t made = 0;
+			auto start = std::chrono::steady_clock::now();
+			double seconds = 0;
+			do
+			{
+				pass();
+				sink += x[made % n] + y[made % n] + z[made % n];
+				made += n;
+				seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			} while (seconds < 0.5);
+			std::cout << sampler << '\t' << mode << '\t' << made / seconds * 1e-6 << '\n';
+		};
+		// Generic so every scalar sampler is called directly, not through a std::function.
+		auto scalar = [&](auto sample)
+		{
+			return [&, sample]
+			{
+				for (int i = 0; i < n; ++i)
+				{
+					vec3 v = sample();
+					x[i] = v.x();
+					y[i] = v.y();
+					z[i] = v.z();
+				}
+			};
+		};
+
+		std::cout << "sampler\tmode\tMsamples/s\n";
+		measure("unit vector", "scalar", scalar([]{ return random_unit_vector(); }));
+		measure("unit vector", "batched", [&]{ random_unit_vectors(n, x.data(), y.data(), z.data()); });
+		measure("cosine", "scalar", scalar([]{ return random_cosine_direction(); }));
+		measure("cosine", "batched", [&]{ random_cosine_directions(n, x.data(), y.data(), z.data()); });
+		measure("unit disk", "scalar", scalar([]{ return random_in_unit_disk(); }));
+		measure("unit disk", "batched", [&]{ random_in_unit_disks(n, x.data(), y.data()); });
+		measure("unit disk", "scalar concentric", scalar([]
+		{
+			auto a = random_double(-1,1);
+			auto b = random_double(-1,1);
+			bool wide = std::fabs(a) > std::fabs(b);
+			auto r = wide ? a : b;
+			auto ratio = (wide ? b : a) / (r + (r == 0));
+			auto phi = wide ? (pi/4) * ratio : (pi/2) - (pi/4) * ratio;
+			return vec3(r*std::cos(phi), r*std::sin(phi), 0);
+		}));
+		measure("unit disk", "batched concentric", [&]{ random_in_unit_disks_concentric(n, x.data(), y.data()); });
+		return(0);
+	}
+
+	// Image
+	const auto aspect_ratio = 16.0 / 9.0;
+	render_settings settings;
+	settings.image_width = opt.image_width;
+	settings.image_height = static_cast<int>(opt.image_width / aspect_ratio);
+	settings.samples_per_pixel = opt.samples_per_pixel;
+	settings.max_depth = opt.max_depth;
+	settings.stream = opt.stream;
+	settings.sort_rays = opt.sort_rays;
+	if (opt.cache_spacing > 0)
+	{
+		settings.cache = std::make_shared<radiance_cache>(opt.cache_spacing, opt.cache_error);
+	}
+
+	// Convergence
+	if (opt.converge)
+	{
+		if (opt.candidates.empty())
+		{
+			opt.candidates.push_back(convergence_candidate());
+		}
+		auto reference_settings = settings;
+		reference_settings.samples_per_pixel = opt.reference_spp;
+		auto slash = opt.report.find_last_of("/\\");
+		std::string dir = slash == std::string::npos ? "." : opt.report.substr(0, slash);
+
+		camera harness_cam(opt.lookfrom, opt.lookat, vec3(0,1,0), opt.vfov, aspect_ratio, opt.aperture, opt.dist_to_focus);
+		convergence_harness harness(pool, harness_cam, reference_settings, dir);
+		harness.time_budget = opt.budget;
+		for (const char* scene : {"cover", "my", "mesh", "window"})
+		{
+			harness.run(scene, opt.candidates);
+		}
+		if (!harness.write_json(opt.report + ".json") || !harness.write_csv(opt.report + ".csv"))
+		{
+			std::cerr << "Could not write " << opt.report << ".json/.csv\n";
+			return(1);
+		}
+		std::cerr << "Wrote " << opt.report << ".json and " << opt.report << ".csv\n";
+		return(0);
+	}
+
+	// World
+	std::shared_ptr<hittable_list> scene;
+	std::shared_ptr<const hittable> world;
+	std::shared_ptr<ooc_scene> ooc;
+	if (!opt.ooc_path.empty())
+	{
+		// Only a missing file is written, anything already there is the user's to remove.
+		if (!std::ifstream(opt.ooc_path).good() && !write_ooc_scene(*build_scene(opt.scene), opt.ooc_path, opt.scene))
+		{
+			std::cerr << "Could not write " << opt.ooc_path << '\n';
+			return(1);
+		}
+		ooc = ooc_scene::open(opt.ooc_path, opt.ooc_cache_mb << 20);
+		if (!ooc)
+		{
+			std::cerr << "Could not open " << opt.ooc_path << ", it is not a scene file or is damaged, remove it to write it again\n";
+			return(1);
+		}
+		if (ooc->scene_name != opt.scene)
+		{
+			std::cerr << opt.ooc_path << " holds scene " << ooc->scene_name << ", not " << opt.scene << ", remove it or pass --scene " << ooc->scene_name << '\n';
+			return(1);
+		}
+		std::cerr << "Out-of-core: " << ooc->chunks() << " chunks, " << opt.ooc_cache_mb << " MB cache\n";
+		world = ooc;
+	}
+	else if (topology.nodes() > 1)
+	{
+		// Built only by threads pinned to the nodes, first touch puts one copy on node 0.
+		// The objects of node 0's copy double as the scene list, they are shared not copied.
+		world = replicated_scene::build(topology, opt.placement, [&]
+		{
+			auto list = build_scene(opt.scene);
+			if (current_numa_node() == 0)
+			{
+				scene = list;
+			}
+			return accelerate(list, opt.accel);
+		});
+		if (opt.placement == SCENE_REPLICATE)
+		{
+			std::cerr << "Scene replicated on " << topology.nodes() << " NUMA nodes\n";
+		}
+	}
+	else
+	{
+		scene = build_scene(opt.scene);
+		world = accelerate(scene, opt.accel);
+	}
+	if (auto tree = std::dynamic_pointer_cast<const qbvh>(world))
+	{
+		std::cerr << "qbvh: " << tree->nodes.size() << " nodes, depth " << tree->depth << ", " << tree->bytes_per_primitive() << " bytes per primitive\n";
+	}
+	else if (auto tree = std::dynamic_pointer_cast<const bvh_node>(world))
+	{
+		auto bytes = static_cast<double>(tree->node_count() * sizeof(bvh_node)) / scene->objects.size();
+		std::cerr << "bvh: " << tree->node_count() << " nodes, " << bytes << " bytes per primitive plus allocation overhead\n";
+	}
 
-	auto ground_material = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
-	world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+	// Camera
+	vec3 vup(0,1,0);
+	camera cam(opt.lookfrom, opt.lookat, vup, opt.vfov, aspect_ratio, opt.aperture, opt.dist_to_focus);
 
-	for (int a = -11; a < 11; a++)
+	// Views
+	if (!opt.views_path.empty())
 	{
-		for (int b = -11; b < 11; b++)
+		std::ifstream list(opt.views_path);
+		if (!list)
+		{
+			std::cerr << "Could not open " << opt.views_path << '\n';
+			return(1);
+		}
+		std::vector<camera> cams;
+		std::vector<std::shared_ptr<output_sink>> sinks;
+		std::string line;
+		for (int number = 1; std::getline(list, line); ++number)
 		{
-			auto choose_mat = random_double();
-			point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+			char from[128], at[128], out[1024];
+			double view_vfov, view_aperture, view_focus;
+			point3 view_from, view_at;
+			if (line.empty() || line[0] == '#')
+			{
+				continue;
+			}
+			if (std::sscanf(line.c_str(), "%127s %127s %lf %lf %lf %1023s", from, at, &view_vfov, &view_aperture, &view_focus, out) != 6 || !parse_vec3(from, view_from) || !parse_vec3(at, view_at))
+			{
+				std::cerr << opt.views_path << ':' << number << ": expected <lookfrom> <lookat> <vfov> <aperture> <focus> <output>\n";
+				return(1);
+			}
+			auto view_sink = std::make_shared<ppm_sink>(out);
+			if (!view_sink->good())
+			{
+				std::cerr << "Could not open " << out << '\n';
+				return(1);
+			}
+			cams.push_back(camera(view_from, view_at, vup, view_vfov, aspect_ratio, view_aperture, view_focus));
+			sinks.push_back(view_sink);
+		}
+
+		auto jobs = render_views(pool, world, cams, settings, sinks);
+		auto all_done = [&]
+		{
+			for (const auto& job : jobs)
+			{
+				if (job->future().wait_for(std::chrono::milliseconds(0)) != std::future_status::ready)
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+		while (!all_done())
+		{
+			double progress = 0;
+			for (const auto& job : jobs)
+			{
+				progress += job->progress();
+			}
+			std::cerr << "\rViews " << static_cast<int>(100 * progress / jobs.size()) << "% " << std::flush;
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		std::cerr << "\rRendered " << jobs.size() << " views\nDone.\n";
+		return(0);
+	}
 
-			if ((center - point3(3, 0.2, 0)).length() > 0.9)
+	// Ray benchmark
+	if (opt.ray_bench)
+	{
+		if (!scene)
+		{
+			std::cerr << "--ray-bench needs an in-memory scene\n";
+			return(1);
+		}
+		// One camera ray per pixel, then one diffuse bounce from wherever they landed, on
+		// this thread only since the point is what a single core does with its stalls.
+		qbvh tree(*scene);
+		std::vector<ray> primary, secondary;
+		for (int j = settings.image_height - 1; j >= 0; --j)
+		{
+			for (int i = 0; i < settings.image_width; ++i)
 			{
-				std::shared_ptr<material> sphere_material;
+				primary.push_back(cam.get_ray((i + 0.5) / (settings.image_width - 1), (j + 0.5) / (settings.image_height - 1)));
+			}
+		}
+		for (const auto& r : primary)
+		{
+			hit_record rec;
+			if (tree.hit(r, 0.001, infinity, rec))
+			{
+				secondary.push_back(ray(rec.p, rec.normal + random_unit_vector()));
+			}
+		}
 
-				if (choose_mat < 0.8)
+		// The bounce rays again, sorted a stream batch at a time the way --sort-rays does it.
+		std::vector<ray> sorted;
+		std::vector<uint64_t> order;
+		aabb bounds;
+		tree.bounding_box(bounds);
+		auto sort_pass = [&]
+		{
+			sorted.clear();
+			for (size_t first = 0; first < secondary.size(); first += settings.stream_batch)
+			{
+				size_t count = std::min(secondary.size() - first, static_cast<size_t>(settings.stream_batch));
+				coherence_order(secondary.data() + first, count, bounds, order);
+				for (auto key : order)
 				{
-					// diffuse
-					auto albedo = random_vec3() * random_vec3();
-					sphere_material = std::make_shared<lambertian>(albedo);
-					world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+					sorted.push_back(secondary[first + static_cast<uint32_t>(key)]);
 				}
-				else if (choose_mat < 0.95)
+			}
+		};
+		sort_pass();
+
+		std::cout << "rays\tmode\tlanes\tMrays/s\n";
+		for (auto set : {std::make_pair("primary", &primary), std::make_pair("secondary", &secondary), std::make_pair("sorted", &sorted)})
+		{
+			const auto& rays = *set.second;
+			std::vector<hit_record> recs(rays.size());
+			std::unique_ptr<bool[]> hits(new bool[rays.size()]);
+			auto measure = [&](const char* mode, int lanes, std::function<void()> pass)
+			{
+				size_t traced = 0;
+				auto start = std::chrono::steady_clock::now();
+				double seconds = 0;
+				do
 				{
-					// metal
-					auto albedo = random_vec3(0.5, 1); 
-					auto fuzz = random_double(0, 0.5);
-					sphere_material = std::make_shared<metal>(albedo, fuzz);
-					world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+					pass();
+					traced += rays.size();
+					seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				} while (seconds < 0.5);
+				std::cout << set.first << '\t' << mode << '\t' << lanes << '\t' << traced / seconds * 1e-6 << '\n';
+			};
+
+			if (set.second == &sorted)
+			{
+				measure("sort", 1, sort_pass);
+			}
+			measure("single", 1, [&]
+			{
+				for (size_t k = 0; k < rays.size(); ++k)
+				{
+					hits[k] = tree.hit(rays[k], 0.001, infinity, recs[k]);
 				}
-				else
+			});
+			for (bool prefetching : {false, true})
+			{
+				tree.stream_prefetch = prefetching;
+				for (int lanes : {1, 4, 8, 16, 32})
 				{
-					// glass
-					sphere_material = std::make_shared<dielectric>(1.5);
-					world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+					tree.stream_lanes = lanes;
+					measure(prefetching ? "stream+prefetch" : "stream", lanes, [&]{ tree.hit_stream(rays.data(), rays.size(), 0.001, infinity, recs.data(), hits.get()); });
 				}
 			}
 		}
+		return(0);
 	}
 
-	auto material1 = std::make_shared<dielectric>(1.5);
-	world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+	// Incremental edits
+	if (opt.edits > 0)
+	{
+		if (!scene)
+		{
+			std::cerr << "--edits needs an in-memory scene\n";
+			return(1);
+		}
+		auto editable = std::make_shared<editable_scene>(*scene);
+		auto timed = [&](incremental_renderer& r, size_t& tiles)
+		{
+			auto start = std::chrono::steady_clock::now();
+			tiles = r.render();
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		};
 
-	auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-	world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+		incremental_renderer frame(pool, editable, settings);
+		frame.set_camera(cam);
+		size_t tiles;
+		double full_seconds = timed(frame, tiles);
+		std::cout << "edit\tobject\tkind\ttiles\tseconds\n"
+		          << "-\t-\tfull\t" << tiles << '\t' << full_seconds << '\n';
 
-	auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-	world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+		// Every other edit recolors a sphere, the rest nudge one sideways.
+		for (int e = 0; e < opt.edits; ++e)
+		{
+			uint32_t index = 0;
+			std::shared_ptr<const sphere> ball;
+			for (int tries = 0; tries < 1000 && !(ball && ball->radius < 10); ++tries)
+			{
+				index = static_cast<uint32_t>(random_double() * editable->size());
+				ball = std::dynamic_pointer_cast<const sphere>(editable->object(index));
+			}
+			if (!ball || ball->radius >= 10)
+			{
+				std::cerr << "--edits needs a scene with small spheres\n";
+				return(1);
+			}
+			bool recolor = e % 2 == 0;
+			if (recolor)
+			{
+				editable->replace(index, std::make_shared<sphere>(ball->center, ball->radius, std::make_shared<lambertian>(random_vec3() * random_vec3())));
+			}
+			else
+			{
+				editable->replace(index, std::make_shared<sphere>(ball->center + vec3(random_double(-1, 1), 0, random_double(-1, 1)), ball->radius, ball->mat_ptr));
+			}
+			double seconds = timed(frame, tiles);
+			std::cout << e << '\t' << index << '\t' << (recolor ? "color" : "move") << '\t' << tiles << '\t' << seconds << '\n';
+		}
 
-	return world;
-}
+		// Stale tiles show up as error above what two full renders differ by.
+		incremental_renderer first(pool, editable, settings), second(pool, editable, settings);
+		first.set_camera(cam);
+		second.set_camera(cam);
+		timed(first, tiles);
+		timed(second, tiles);
+		int w = settings.image_width, h = settings.image_height;
+		std::cout << "rmse against a full render\t" << compare_images(frame.pixels, first.pixels, w, h).rmse << '\n'
+		          << "rmse of two full renders\t" << compare_images(second.pixels, first.pixels, w, h).rmse << '\n';
 
-hittable_list my_scene()
-{
-	hittable_list world;
-
- 	auto material_ground = std::make_shared<lambertian>(color(0.11, 0.21, 0.18));
-	auto material_center = std::make_shared<dielectric>(1.5);
-	auto material_water = std::make_shared<dielectric>(1.333);
-	auto material_left   = std::make_shared<dielectric>(1.7);
-	auto material_right  = std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.1);
-	
-	world.add(std::make_shared<sphere>(point3( 0.5,   0.0, -1),   0.5,     material_right));
-	world.add(std::make_shared<sphere>(point3( 0.0, -0.25, -0),  0.25,     material_center));
-	world.add(std::make_shared<sphere>(point3( 0.0, -0.25, -0), -0.15,     material_water));
-	world.add(std::make_shared<sphere>(point3(-0.5,   0.0, -1),   0.5,     material_left));
-	world.add(std::make_shared<sphere>(point3(-0.5,   0.0, -1),  -0.3,     material_left));
-	world.add(std::make_shared<sphere>(point3( 0.0,-100.5, -1), 100.0,     material_ground));
-
-	return world;
-}
+		ppm_sink out(opt.path);
+		frame.write(out);
+		return(0);
+	}
 
-void render(std::ostream& out, const camera& cam, const hittable_list& world, int image_width, int image_height, int max_height, int min_height, int samples_per_pixel, int max_depth)
-{
-	for (int j = max_height-1; j >= min_height; --j)
+	// Path guide
+	if (opt.guide_passes > 0)
+	{
+		settings.guide = std::make_shared<path_guide>(opt.guide_spacing);
+		auto start = std::chrono::steady_clock::now();
+		train_guide(pool, world, cam, settings, opt.guide_passes);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cerr << "Path guide: " << settings.guide->cells_ready() << " cells trained in " << seconds << " s\n";
+	}
+
+	// Radiance cache comparison
+	if (opt.cache_compare && settings.cache)
+	{
+		auto time_render = [&](const render_settings& s, image_sink& out)
+		{
+			auto start = std::chrono::steady_clock::now();
+			render_job::launch(pool, world, cam, s, std::shared_ptr<output_sink>(&out, [](output_sink*){}))->wait();
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		};
+		auto brute_settings = settings;
+		brute_settings.cache.reset();
+		image_sink brute, cached;
+		double brute_seconds = time_render(brute_settings, brute);
+		double cached_seconds = time_render(settings, cached);
+		auto error = compare_images(cached.pixels, brute.pixels, brute.width, brute.height);
+
+		std::ofstream out(opt.path);
+		out << "P3\n" << cached.width << ' ' << cached.height << "\n255\n";
+		for (const auto& pixel : cached.pixels)
+		{
+			write_color(out, pixel, 1);
+		}
+
+		std::cout << "brute force\t" << brute_seconds << " s\n"
+		          << "cached\t" << cached_seconds << " s, " << settings.cache->cells_used() << " cells, "
+		          << settings.cache->answered << " of " << settings.cache->lookups << " lookups answered\n"
+		          << "speedup\t" << brute_seconds / cached_seconds << '\n'
+		          << "rmse\t" << error.rmse << "\nrelmse\t" << error.relmse << "\nflip\t" << error.flip << '\n';
+		return(0);
+	}
+
+	// Scaling
+	if (opt.scaling)
 	{
-		std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-		for (int i = 0; i < image_width; ++i)
+		// Fresh pool per thread count, same pinning, rows land in memory and are thrown away.
+		std::cerr << topology.nodes() << " NUMA node(s)\n";
+		std::cout << "threads\tseconds\tspeedup\tefficiency\n";
+		double single = 0;
+		for (size_t threads = 1; threads <= opt.num_threads; threads = threads < opt.num_threads && threads * 2 > opt.num_threads ? opt.num_threads : threads * 2)
 		{
-			color pixel_color(0, 0, 0);
-			for (int s = 0; s < samples_per_pixel; ++s)
+			thread_pool scaling_pool(threads, opt.pin);
+			auto start = std::chrono::steady_clock::now();
+			render_job::launch(scaling_pool, world, cam, settings, std::make_shared<image_sink>())->wait();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (threads == 1)
+			{
+				single = seconds;
+			}
+			std::cout << threads << '\t' << seconds << '\t' << single / seconds << '\t' << single / seconds / threads << '\n';
+			if (threads == opt.num_threads)
 			{
-				auto u = (i + random_double()) / (image_width-1);
-				auto v = (j + random_double()) / (image_height-1);
-				ray r = cam.get_ray(u, v);
-				pixel_color += ray_color(r, world, max_depth);
+				break;
 			}
-			write_color(out, pixel_color, samples_per_pixel);
 		}
+		return(0);
 	}
-}
-
-int main() {
-	// File
-	std::ofstream helloFile;
-	char path[] = "../data/image.ppm";
-
-	// Threads
-	size_t num_threads = std::thread::hardware_concurrency();
-	std::vector<std::thread> pool;
-	std::vector<std::stringstream> s_pool(num_threads);
-	
-	// TODO: Fool proof file io
-	helloFile.open(path);
 
-	// Image
-	const auto aspect_ratio = 16.0 / 9.0;
-	const int image_width = nHD; // nHD: 640, qHD: 960, HD: 1280, Full HD: 1920, QHD: 2560, 4K UHD: 3840
-	const int image_height = static_cast<int>(image_width / aspect_ratio);
-	const int samples_per_pixel = 500;
-	const int max_depth = 50;
+	// Preview
+	if (opt.interactive_preview)
+	{
+		// Rewrites the image after every pass so a viewer that reloads on change shows the
+		// refinement, keeps going until enter is pressed.
+		preview_settings pv_settings;
+		pv_settings.image_width = settings.image_width;
+		pv_settings.image_height = settings.image_height;
+		pv_settings.max_samples_per_pixel = settings.samples_per_pixel;
+		pv_settings.max_depth = settings.max_depth;
 
-	// World
-	auto world = cover_scene();
-//	auto world = my_scene();
-	
-	auto material_ground = std::make_shared<lambertian>(color(1,0,0));
-	world.add(std::make_shared<triangle>(vec3(0,-0.25,0),vec3(1,-0.25,0),vec3(1,0.75,0),material_ground));
+		preview pv(pool, *world, pv_settings, [&](const framebuffer& fb)
+		{
+			std::ofstream frame(opt.path);
+			frame << "P3\n" << fb.width << ' ' << fb.height << "\n255\n";
+			for (const auto& pixel : fb.pixels)
+			{
+				write_color(frame, pixel, 1);
+			}
+			std::cerr << "\rPreview 1/" << fb.level << " resolution, " << fb.samples_per_pixel << " spp " << std::flush;
+		});
+		pv.start(cam);
+		std::cin.get();
+		pv.stop();
 
-	// Camera
-	point3 lookfrom(13,2,3);
-	point3 lookat(0,0,0);
-	vec3 vup(0,1,0);
-	auto dist_to_focus = 13.5;
-	auto aperture = 0.1;
+		std::cerr << "\nDone.\n";
+		return(0);
+	}
 
-	camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
-	
 	// Render
-	helloFile << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-	
-	for (size_t i = 0; i < num_threads; i++)
+	auto sink = std::make_shared<ppm_sink>(opt.path);
+	if (!sink->good())
 	{
-		int max_h = image_height * (num_threads - i) / num_threads;
-		int min_h = image_height * (num_threads - (i + 1)) / num_threads;
-		pool.push_back(std::thread(&render, std::ref(s_pool[i]), std::ref(cam), std::ref(world), image_width, image_height, max_h, min_h, samples_per_pixel, max_depth));
+		std::cerr << "Could not open " << opt.path << '\n';
+		return(1);
 	}
 
-	for (auto& th : pool)
+	auto job = render_job::launch(pool, world, cam, settings, sink);
+	while (job->future().wait_for(std::chrono::milliseconds(100)) != std::future_status::ready)
 	{
-		th.join();
+		int remaining = settings.image_height - static_cast<int>(job->progress() * settings.image_height + 0.5);
+		std::cerr << "\rScanlines remaining: " << remaining << ' ' << std::flush;
 	}
+	job->wait();
 
-	for (auto& ss : s_pool)
+	if (ooc)
 	{
-		helloFile << ss.str();
+		std::cerr << "\nOut-of-core: " << ooc->misses << " chunk loads, " << ooc->hits << " cache hits, " << ooc->evictions << " evictions, peak " << (ooc->peak_bytes >> 20) << " MB resident";
 	}
-
-//	render(ss, cam, world, image_width, image_height, samples_per_pixel, max_depth);
-
-	helloFile.close();
-
 	std::cerr << "\nDone.\n";
 	return(0);
 }
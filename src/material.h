@@ -3,11 +3,19 @@
 
 #include "rtweekend.h"
 
+#include "onb.h"
+
 struct hit_record;
 
 typedef struct material
 {
 	virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+	//!	function telling whether the material scatters ideally diffuse, so its incoming light may be cached.
+	virtual bool diffuse() const
+	{
+		return false;
+	}
 } material;
 
 typedef struct lambertian : material
@@ -18,19 +26,21 @@ typedef struct lambertian : material
 
 	virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override
 	{
-		auto scatter_direction = rec.normal + random_unit_vector();
-
-		// Catch degenrate scatter direction
-		if (scatter_direction.near_zero())
-		{
-			scatter_direction = rec.normal;
-		}
+		// Cosine weighted around the normal, the same distribution as normal + random_unit_vector()
+		// but it can never come out degenerate.
+		onb uvw;
+		uvw.build_from_w(rec.normal);
+		auto scatter_direction = uvw.local(random_cosine_direction());
 
 		scattered = ray(rec.p, scatter_direction);
 		attenuation = albedo;
 		return true;
 	}
 
+	virtual bool diffuse() const override
+	{
+		return true;
+	}
 } lambertian;
 
 typedef struct metal : material
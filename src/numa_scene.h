@@ -0,0 +1,91 @@
+#ifndef NUMA_SCENE_H
+#define NUMA_SCENE_H
+
+#include "rtweekend.h"
+
+#include "affinity.h"
+#include "hittable.h"
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//!	How the scene is laid out in memory on a machine with several NUMA nodes.
+enum scene_placement { SCENE_FIRST_TOUCH, SCENE_REPLICATE };
+
+//!	replicated_scene struct.
+/*!
+	One copy of the scene per NUMA node, each built by a thread pinned to that node so the
+	operating system's first touch policy puts its pages in that node's memory. Queries go
+	to the copy of the node the calling pool worker runs on, so traversal never reads
+	memory across the interconnect. The builder has to produce the same scene every call.
+*/
+typedef struct replicated_scene : hittable
+{
+	std::vector<std::shared_ptr<const hittable>> replicas;
+
+	static std::shared_ptr<const hittable> build(const numa_topology& topology, scene_placement placement, std::function<std::shared_ptr<const hittable>()> builder);
+
+	const hittable& local() const
+	{
+		size_t node = static_cast<size_t>(current_numa_node());
+		return *replicas[node < replicas.size() ? node : 0];
+	}
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override
+	{
+		return local().hit(r, t_min, t_max, rec);
+	}
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override
+	{
+		return local().occluded(r, t_min, t_max);
+	}
+	virtual void hit_stream(const ray* rays, size_t count, double t_min, double t_max, hit_record* recs, bool* hits) const override
+	{
+		local().hit_stream(rays, count, t_min, t_max, recs, hits);
+	}
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		return replicas[0]->bounding_box(output_box);
+	}
+} replicated_scene;
+
+//!	function to build the scene with the given placement.
+/*!
+	\param topology numa_topology& the nodes to place copies on.
+	\param placement scene_placement first touch builds one copy from a thread on node 0,
+		replicate builds one per node.
+	\param builder function returning a freshly built scene.
+	\return shared_ptr<const hittable> the scene to render.
+*/
+std::shared_ptr<const hittable> replicated_scene::build(const numa_topology& topology, scene_placement placement, std::function<std::shared_ptr<const hittable>()> builder)
+{
+	size_t copies = placement == SCENE_REPLICATE ? topology.nodes() : 1;
+	std::vector<std::shared_ptr<const hittable>> built(copies);
+	std::vector<std::thread> builders;
+
+	for (size_t node = 0; node < copies; ++node)
+	{
+		builders.push_back(std::thread([&, node]()
+		{
+			pin_current_thread(topology.node_cpus[node][0]);
+			current_numa_node() = static_cast<int>(node);
+			built[node] = builder();
+		}));
+	}
+	for (auto& th : builders)
+	{
+		th.join();
+	}
+
+	if (copies == 1)
+	{
+		return built[0];
+	}
+	auto scene = std::make_shared<replicated_scene>();
+	scene->replicas = built;
+	return scene;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "rtweekend.h"
+
+//!	onb struct.
+/*!
+	An orthonormal basis, used to take directions sampled around the z axis into world space.
+*/
+typedef struct onb
+{
+	vec3 axis[3];
+
+	onb() {}
+
+	vec3 u() const
+	{
+		return axis[0];
+	}
+	vec3 v() const
+	{
+		return axis[1];
+	}
+	vec3 w() const
+	{
+		return axis[2];
+	}
+
+	//!	function to transform a direction given in the local basis into world space.
+	/*!
+		\param a vec3& local direction, z being along w.
+		\return vec3 the world space direction.
+	*/
+	vec3 local(const vec3& a) const
+	{
+		return a.x()*axis[0] + a.y()*axis[1] + a.z()*axis[2];
+	}
+
+	void build_from_w(const vec3& n);
+} onb;
+
+//!	function to build the basis around a unit normal.
+/*!
+	Branchless construction from Duff et al. "Building an Orthonormal Basis, Revisited",
+	there is no cross product with a helper axis and no special case near the poles.
+	\param n vec3& unit vector that becomes w.
+*/
+void onb::build_from_w(const vec3& n)
+{
+	auto sign = std::copysign(1.0, n.z());
+	auto a = -1.0 / (sign + n.z());
+	auto b = n.x() * n.y() * a;
+
+	axis[0] = vec3(1.0 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+	axis[1] = vec3(b, sign + n.y() * n.y() * a, -n.y());
+	axis[2] = n;
+}
+
+//!	function to generate a cosine weighted direction in the hemisphere around +z.
+/*!
+	Malley's method, a uniform disk sample projected up onto the hemisphere.
+	\return a unit vec3 with pdf cos(theta)/pi.
+*/
+vec3 random_cosine_direction()
+{
+	auto r1 = random_double();
+	auto r2 = random_double();
+
+	auto phi = 2*pi*r1;
+	auto r = std::sqrt(r2);
+	auto z = std::sqrt(1 - r2);
+
+	return vec3(r*std::cos(phi), r*std::sin(phi), z);
+}
+
+#endif
@@ -0,0 +1,936 @@
+#ifndef OOC_H
+#define OOC_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// On disk layout of an out-of-core scene, all records are plain data written as they are
+// laid out in memory, so a chunk is paged in with one copy and no pointer fixups.
+//
+//	ooc_header
+//	ooc_material[material_count]
+//	ooc_sphere[sphere_count]
+//	ooc_chunk[chunk_count]
+//	per chunk, starting on a page boundary: ooc_node[node_count] ooc_triangle[triangle_count]
+
+const size_t ooc_page = 4096;
+
+typedef struct ooc_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t material_count;
+	uint32_t sphere_count;
+	uint32_t chunk_count;
+	char scene[32];		// name of the scene written, zero padded
+} ooc_header;
+
+typedef struct ooc_material
+{
+	uint32_t type;		// 0 lambertian, 1 metal, 2 dielectric
+	uint32_t pad;
+	double p[4];		// albedo and fuzz, or the index of refraction
+} ooc_material;
+
+typedef struct ooc_sphere
+{
+	double center[3];
+	double radius;
+	uint32_t material;
+	uint32_t pad;
+} ooc_sphere;
+
+typedef struct ooc_chunk
+{
+	uint64_t offset;
+	uint64_t node_count;
+	uint64_t triangle_count;
+	double lo[3], hi[3];
+} ooc_chunk;
+
+//!	ooc_node struct.
+/*!
+	Binary tree node in depth first order. Interior nodes have count 0, their left child is
+	the next node and index is the right child. Leaves cover count items from index on.
+*/
+typedef struct ooc_node
+{
+	double lo[3], hi[3];
+	uint32_t index;
+	uint32_t count;
+} ooc_node;
+
+typedef struct ooc_triangle
+{
+	double v0[3], v1[3], v2[3];
+	double normal[3];
+	uint32_t material;
+	uint32_t pad;
+} ooc_triangle;
+
+//!	mapped_file struct.
+/*!
+	A read only memory mapping of a whole file.
+*/
+typedef struct mapped_file
+{
+	mapped_file() {}
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	bool open(const std::string& path);
+	void release(size_t offset, size_t bytes) const;
+
+	const unsigned char* data() const
+	{
+		return base;
+	}
+	size_t size() const
+	{
+		return length;
+	}
+
+	private:
+	const unsigned char* base = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+} mapped_file;
+
+mapped_file::~mapped_file()
+{
+#ifdef _WIN32
+	if (base)
+	{
+		UnmapViewOfFile(base);
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+#else
+	if (base)
+	{
+		munmap(const_cast<unsigned char*>(base), length);
+	}
+#endif
+}
+
+bool mapped_file::open(const std::string& path)
+{
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER file_size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		return false;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		return false;
+	}
+	base = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	length = static_cast<size_t>(file_size.QuadPart);
+	return base != nullptr;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+	{
+		return false;
+	}
+	base = static_cast<const unsigned char*>(p);
+	length = static_cast<size_t>(st.st_size);
+	return true;
+#endif
+}
+
+//!	function to drop the pages of a range from the mapping once it has been copied out.
+/*!
+	The pages stay in the operating system's file cache, where they can be reclaimed, but
+	no longer count against the process. Windows reclaims mapped views on its own.
+*/
+void mapped_file::release(size_t offset, size_t bytes) const
+{
+#ifndef _WIN32
+	size_t first = offset / ooc_page * ooc_page;
+	madvise(const_cast<unsigned char*>(base) + first, offset + bytes - first, MADV_DONTNEED);
+#else
+	(void)offset;
+	(void)bytes;
+#endif
+}
+
+// Median split on the longest centroid axis, leaves of at most leaf_size items.
+inline uint32_t build_ooc_nodes(const std::vector<aabb>& boxes, std::vector<uint32_t>& order, size_t start, size_t end, size_t leaf_size, std::vector<ooc_node>& nodes)
+{
+	uint32_t self = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(ooc_node());
+
+	aabb bounds, centroids;
+	for (size_t i = start; i < end; ++i)
+	{
+		bounds = surrounding_box(bounds, boxes[order[i]]);
+		auto c = boxes[order[i]].centroid();
+		centroids = surrounding_box(centroids, aabb(c, c));
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		nodes[self].lo[k] = bounds.min()[k];
+		nodes[self].hi[k] = bounds.max()[k];
+	}
+
+	if (end - start <= leaf_size)
+	{
+		nodes[self].index = static_cast<uint32_t>(start);
+		nodes[self].count = static_cast<uint32_t>(end - start);
+		return self;
+	}
+
+	int axis = centroids.longest_axis();
+	size_t mid = start + (end - start) / 2;
+	std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b)
+	{
+		return boxes[a].centroid()[axis] < boxes[b].centroid()[axis];
+	});
+
+	build_ooc_nodes(boxes, order, start, mid, leaf_size, nodes);
+	uint32_t right = build_ooc_nodes(boxes, order, mid, end, leaf_size, nodes);
+	nodes[self].index = right;
+	nodes[self].count = 0;
+	return self;
+}
+
+// A walk holds at most depth + 1 entries, trees deeper than ooc_max_stack - 1 are refused.
+const int ooc_max_stack = 64;
+
+//!	function to measure a node array laid out by build_ooc_nodes().
+/*!
+	Also checks the layout, every child index has to lie after its parent and inside the
+	array and every node has to be reached exactly once, so the result can be trusted for
+	a tree read from a file.
+	\param nodes ooc_node* the tree, nodes[0] being the root.
+	\param count size_t number of nodes.
+	\param limit int deepest tree accepted.
+	\return int node levels, or -1 if the layout is broken or deeper than limit.
+*/
+inline int ooc_depth(const ooc_node* nodes, size_t count, int limit)
+{
+	struct entry { size_t node; int level; };
+	std::vector<entry> pending;
+	pending.push_back(entry{0, 1});
+	size_t visited = 0;
+	int depth = 0;
+	while (!pending.empty())
+	{
+		entry e = pending.back();
+		pending.pop_back();
+		if (e.node >= count || e.level > limit || ++visited > count)
+		{
+			return -1;
+		}
+		depth = std::max(depth, e.level);
+		const ooc_node& n = nodes[e.node];
+		if (n.count == 0)
+		{
+			if (n.index <= e.node)
+			{
+				return -1;
+			}
+			pending.push_back(entry{e.node + 1, e.level + 1});
+			pending.push_back(entry{n.index, e.level + 1});
+		}
+	}
+	return visited == count ? depth : -1;
+}
+
+//!	function to check one chunk of a mapped scene file before anything pages it in.
+/*!
+	The records have to lie inside the file, the tree has to be well formed and no deeper
+	than a walk can hold, every leaf has to stay inside the chunk's triangles and every
+	triangle has to name a material that exists.
+	\param chunk ooc_chunk& the chunk's table entry.
+	\param data unsigned char* the mapped file.
+	\param size size_t bytes in the file.
+	\param material_count size_t materials in the file.
+	\return bool false if the chunk cannot be rendered safely.
+*/
+inline bool ooc_chunk_valid(const ooc_chunk& chunk, const unsigned char* data, size_t size, size_t material_count)
+{
+	if (chunk.offset % ooc_page != 0 || chunk.offset > size || chunk.node_count == 0 || chunk.triangle_count > 0xffffffffu)
+	{
+		return false;
+	}
+	size_t left = size - chunk.offset;
+	if (chunk.node_count > left / sizeof(ooc_node) || chunk.triangle_count > (left - chunk.node_count * sizeof(ooc_node)) / sizeof(ooc_triangle))
+	{
+		return false;
+	}
+
+	// Chunks start on a page boundary, so the records are aligned in the mapping.
+	auto nodes = reinterpret_cast<const ooc_node*>(data + chunk.offset);
+	auto tris = reinterpret_cast<const ooc_triangle*>(data + chunk.offset + chunk.node_count * sizeof(ooc_node));
+	if (ooc_depth(nodes, chunk.node_count, ooc_max_stack - 1) < 0)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < chunk.node_count; ++i)
+	{
+		if (nodes[i].count != 0 && uint64_t(nodes[i].index) + nodes[i].count > chunk.triangle_count)
+		{
+			return false;
+		}
+	}
+	for (size_t i = 0; i < chunk.triangle_count; ++i)
+	{
+		if (tris[i].material >= material_count)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//!	function to write a scene out for out-of-core rendering.
+/*!
+	Triangles are sorted along a Morton curve and cut into chunks of triangles_per_chunk, so
+	a chunk is a compact piece of the scene, then each chunk gets its own tree. Spheres are
+	few and stay resident when the file is opened. The scene has to fit in memory to be
+	written, a converter for bigger assets would stream its input the same way.
+	The file is written next to path and renamed into place once complete, so a failed
+	write never leaves a partial scene behind to be opened later.
+	\param world hittable_list& the scene, triangles and spheres with the book's materials.
+	\param path string& file to write.
+	\param scene_name string& recorded in the file, see ooc_scene::scene_name.
+	\param triangles_per_chunk size_t triangles per chunk, the unit of paging.
+	\return bool false if the scene holds something the format cannot store, or on I/O errors.
+*/
+bool write_ooc_scene(const hittable_list& world, const std::string& path, const std::string& scene_name, size_t triangles_per_chunk = 4096)
+{
+	std::vector<const triangle*> tris;
+	std::vector<ooc_material> materials;
+	std::unordered_map<const material*, uint32_t> material_index;
+
+	auto add_material = [&](const std::shared_ptr<material>& m, uint32_t& index)
+	{
+		auto found = material_index.find(m.get());
+		if (found != material_index.end())
+		{
+			index = found->second;
+			return true;
+		}
+		ooc_material om = {};
+		if (auto l = dynamic_cast<const lambertian*>(m.get()))
+		{
+			om.type = 0;
+			om.p[0] = l->albedo[0]; om.p[1] = l->albedo[1]; om.p[2] = l->albedo[2];
+		}
+		else if (auto mt = dynamic_cast<const metal*>(m.get()))
+		{
+			om.type = 1;
+			om.p[0] = mt->albedo[0]; om.p[1] = mt->albedo[1]; om.p[2] = mt->albedo[2]; om.p[3] = mt->fuzz;
+		}
+		else if (auto d = dynamic_cast<const dielectric*>(m.get()))
+		{
+			om.type = 2;
+			om.p[0] = d->ir;
+		}
+		else
+		{
+			return false;
+		}
+		index = static_cast<uint32_t>(materials.size());
+		material_index[m.get()] = index;
+		materials.push_back(om);
+		return true;
+	};
+
+	std::vector<ooc_sphere> sphere_records;
+	for (const auto& object : world.objects)
+	{
+		uint32_t index;
+		if (auto t = dynamic_cast<const triangle*>(object.get()))
+		{
+			tris.push_back(t);
+		}
+		else if (auto s = dynamic_cast<const sphere*>(object.get()))
+		{
+			ooc_sphere os = {};
+			if (!add_material(s->mat_ptr, index))
+			{
+				return false;
+			}
+			for (int k = 0; k < 3; ++k)
+			{
+				os.center[k] = s->center[k];
+			}
+			os.radius = s->radius;
+			os.material = index;
+			sphere_records.push_back(os);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	// Morton order over the centroids.
+	aabb centroids;
+	for (auto t : tris)
+	{
+		point3 c = (t->tri.v0 + t->tri.v1 + t->tri.v2) / 3;
+		centroids = surrounding_box(centroids, aabb(c, c));
+	}
+	vec3 extent = centroids.max() - centroids.min();
+	std::vector<std::pair<uint32_t, const triangle*>> keyed;
+	keyed.reserve(tris.size());
+	for (auto t : tris)
+	{
+		point3 c = (t->tri.v0 + t->tri.v1 + t->tri.v2) / 3;
+		uint32_t code = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			double u = extent[k] > 0 ? (c[k] - centroids.min()[k]) / extent[k] : 0;
+			code |= morton_spread(static_cast<uint32_t>(clamp(u, 0, 1) * 1023)) << k;
+		}
+		keyed.push_back(std::make_pair(code, t));
+	}
+	std::stable_sort(keyed.begin(), keyed.end(), [](const std::pair<uint32_t, const triangle*>& a, const std::pair<uint32_t, const triangle*>& b)
+	{
+		return a.first < b.first;
+	});
+
+	// Build every chunk's records up front, the offsets follow from their sizes.
+	triangles_per_chunk = std::max<size_t>(triangles_per_chunk, 1);
+	std::vector<ooc_chunk> chunks;
+	std::vector<std::vector<ooc_node>> chunk_nodes;
+	std::vector<std::vector<ooc_triangle>> chunk_tris;
+	for (size_t first = 0; first < keyed.size(); first += triangles_per_chunk)
+	{
+		size_t last = std::min(first + triangles_per_chunk, keyed.size());
+		std::vector<aabb> boxes;
+		std::vector<uint32_t> order;
+		for (size_t i = first; i < last; ++i)
+		{
+			aabb box;
+			keyed[i].second->bounding_box(box);
+			boxes.push_back(box);
+			order.push_back(static_cast<uint32_t>(i - first));
+		}
+
+		std::vector<ooc_node> nodes;
+		build_ooc_nodes(boxes, order, 0, order.size(), 4, nodes);
+
+		std::vector<ooc_triangle> records;
+		for (auto i : order)
+		{
+			const triangle* t = keyed[first + i].second;
+			ooc_triangle ot = {};
+			for (int k = 0; k < 3; ++k)
+			{
+				ot.v0[k] = t->tri.v0[k];
+				ot.v1[k] = t->tri.v1[k];
+				ot.v2[k] = t->tri.v2[k];
+				ot.normal[k] = t->tri.normal[k];
+			}
+			if (!add_material(t->mat_ptr, ot.material))
+			{
+				return false;
+			}
+			records.push_back(ot);
+		}
+
+		ooc_chunk chunk = {};
+		chunk.node_count = nodes.size();
+		chunk.triangle_count = records.size();
+		for (int k = 0; k < 3; ++k)
+		{
+			chunk.lo[k] = nodes[0].lo[k];
+			chunk.hi[k] = nodes[0].hi[k];
+		}
+		chunks.push_back(chunk);
+		chunk_nodes.push_back(std::move(nodes));
+		chunk_tris.push_back(std::move(records));
+	}
+
+	auto align = [](size_t offset)
+	{
+		return (offset + ooc_page - 1) / ooc_page * ooc_page;
+	};
+	size_t offset = align(sizeof(ooc_header) + materials.size() * sizeof(ooc_material) + sphere_records.size() * sizeof(ooc_sphere) + chunks.size() * sizeof(ooc_chunk));
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		chunks[c].offset = offset;
+		offset = align(offset + chunk_nodes[c].size() * sizeof(ooc_node) + chunk_tris[c].size() * sizeof(ooc_triangle));
+	}
+
+	std::string temp = path + ".tmp";
+	std::ofstream out(temp, std::ios::binary);
+	ooc_header header = {};
+	std::memcpy(header.magic, "RTOOC\0\0\0", 8);
+	header.version = 2;
+	scene_name.copy(header.scene, sizeof(header.scene) - 1);
+	header.material_count = static_cast<uint32_t>(materials.size());
+	header.sphere_count = static_cast<uint32_t>(sphere_records.size());
+	header.chunk_count = static_cast<uint32_t>(chunks.size());
+
+	auto write = [&](const void* p, size_t bytes)
+	{
+		out.write(static_cast<const char*>(p), static_cast<std::streamsize>(bytes));
+	};
+	auto pad_to = [&](size_t position)
+	{
+		static const char zeros[ooc_page] = {};
+		if (!out)
+		{
+			return;
+		}
+		size_t at = static_cast<size_t>(out.tellp());
+		write(zeros, position - at);
+	};
+	write(&header, sizeof(header));
+	write(materials.data(), materials.size() * sizeof(ooc_material));
+	write(sphere_records.data(), sphere_records.size() * sizeof(ooc_sphere));
+	write(chunks.data(), chunks.size() * sizeof(ooc_chunk));
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		pad_to(chunks[c].offset);
+		write(chunk_nodes[c].data(), chunk_nodes[c].size() * sizeof(ooc_node));
+		write(chunk_tris[c].data(), chunk_tris[c].size() * sizeof(ooc_triangle));
+	}
+	pad_to(offset);
+	out.close();
+	if (!out)
+	{
+		std::remove(temp.c_str());
+		return false;
+	}
+#ifdef _WIN32
+	std::remove(path.c_str());	// rename does not replace an existing file here
+#endif
+	if (std::rename(temp.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+//!	ooc_scene struct.
+/*!
+	A scene rendered straight from a file written by write_ooc_scene(). The file is memory
+	mapped, only the chunk table, a small tree over the chunk boxes and the spheres are kept
+	in memory. Chunks, each a subtree with its triangles, are copied in when a ray first
+	reaches them and held in an LRU cache of cache_bytes, evicting the least recently used.
+
+	A ray that needs a chunk somebody else is already loading waits for that one load rather
+	than reading it again, so every miss costs one read however many rays queue up on it.
+	Evicted chunks live on until the rays still traversing them are done, so the memory in
+	use can exceed the budget by about one chunk per worker.
+*/
+typedef struct ooc_scene : hittable
+{
+	typedef struct resident_chunk
+	{
+		std::vector<ooc_node> nodes;
+		std::vector<ooc_triangle> tris;
+		size_t bytes;
+	} resident_chunk;
+
+	size_t cache_bytes = 0;
+	std::string scene_name;		// the scene the file was written from
+	mutable std::atomic<size_t> hits{0}, misses{0}, evictions{0};
+	mutable std::atomic<size_t> peak_bytes{0};
+
+	static std::shared_ptr<ooc_scene> open(const std::string& path, size_t cache_bytes);
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
+
+	size_t chunks() const
+	{
+		return table.size();
+	}
+	size_t resident_bytes() const;
+
+	private:
+	typedef std::shared_future<std::shared_ptr<const resident_chunk>> entry;
+
+	mapped_file file;
+	std::vector<std::shared_ptr<material>> materials;
+	std::shared_ptr<const hittable> resident;	// the spheres
+	std::vector<ooc_chunk> table;
+	std::vector<ooc_node> top;			// tree over the chunk boxes
+	std::vector<uint32_t> top_order;
+
+	mutable std::mutex m;
+	mutable std::list<std::pair<uint32_t, entry>> lru;	// front is the most recently used, loaded chunks only
+	mutable std::unordered_map<uint32_t, entry> loading;
+	mutable std::unordered_map<uint32_t, std::list<std::pair<uint32_t, entry>>::iterator> index;
+	mutable size_t used = 0;
+
+	std::shared_ptr<const resident_chunk> fetch(uint32_t chunk) const;
+	template <bool any_hit>
+	bool traverse(const ray& r, double t_min, double& t_max, hit_record* rec) const;
+} ooc_scene;
+
+//!	function to map a scene file.
+/*!
+	Every chunk is checked up front, which reads the whole file once, so a truncated or
+	damaged file is refused here rather than faulting in the middle of a render.
+	\param path string& file written by write_ooc_scene().
+	\param cache_bytes size_t memory for resident chunks.
+	\return shared_ptr<ooc_scene> the scene, nullptr if the file is missing, not a scene or damaged.
+*/
+std::shared_ptr<ooc_scene> ooc_scene::open(const std::string& path, size_t cache_bytes)
+{
+	auto scene = std::make_shared<ooc_scene>();
+	scene->cache_bytes = cache_bytes;
+	if (!scene->file.open(path) || scene->file.size() < sizeof(ooc_header))
+	{
+		return nullptr;
+	}
+
+	ooc_header header;
+	std::memcpy(&header, scene->file.data(), sizeof(header));
+	size_t table_end = sizeof(header) + header.material_count * sizeof(ooc_material) + header.sphere_count * sizeof(ooc_sphere) + header.chunk_count * sizeof(ooc_chunk);
+	if (std::memcmp(header.magic, "RTOOC\0\0\0", 8) != 0 || header.version != 2 || scene->file.size() < table_end)
+	{
+		return nullptr;
+	}
+	header.scene[sizeof(header.scene) - 1] = '\0';
+	scene->scene_name = header.scene;
+
+	const unsigned char* at = scene->file.data() + sizeof(header);
+	for (uint32_t i = 0; i < header.material_count; ++i, at += sizeof(ooc_material))
+	{
+		ooc_material om;
+		std::memcpy(&om, at, sizeof(om));
+		if (om.type > 2)
+		{
+			return nullptr;
+		}
+		color albedo(om.p[0], om.p[1], om.p[2]);
+		if      (om.type == 0)	scene->materials.push_back(std::make_shared<lambertian>(albedo));
+		else if (om.type == 1)	scene->materials.push_back(std::make_shared<metal>(albedo, om.p[3]));
+		else			scene->materials.push_back(std::make_shared<dielectric>(om.p[0]));
+	}
+
+	auto spheres = std::make_shared<hittable_list>();
+	for (uint32_t i = 0; i < header.sphere_count; ++i, at += sizeof(ooc_sphere))
+	{
+		ooc_sphere os;
+		std::memcpy(&os, at, sizeof(os));
+		if (os.material >= header.material_count)
+		{
+			return nullptr;
+		}
+		spheres->add(std::make_shared<sphere>(point3(os.center[0], os.center[1], os.center[2]), os.radius, scene->materials[os.material]));
+	}
+	scene->resident = accelerate(spheres);
+
+	scene->table.resize(header.chunk_count);
+	std::memcpy(scene->table.data(), at, header.chunk_count * sizeof(ooc_chunk));
+	for (const auto& chunk : scene->table)
+	{
+		if (!ooc_chunk_valid(chunk, scene->file.data(), scene->file.size(), header.material_count))
+		{
+			return nullptr;
+		}
+		// Give the pages back, the chunk is read again when a ray first needs it.
+		scene->file.release(chunk.offset, chunk.node_count * sizeof(ooc_node) + chunk.triangle_count * sizeof(ooc_triangle));
+	}
+
+	std::vector<aabb> boxes;
+	for (const auto& chunk : scene->table)
+	{
+		boxes.push_back(aabb(point3(chunk.lo[0], chunk.lo[1], chunk.lo[2]), point3(chunk.hi[0], chunk.hi[1], chunk.hi[2])));
+		scene->top_order.push_back(static_cast<uint32_t>(scene->top_order.size()));
+	}
+	if (!boxes.empty())
+	{
+		build_ooc_nodes(boxes, scene->top_order, 0, boxes.size(), 1, scene->top);
+		assert(ooc_depth(scene->top.data(), scene->top.size(), ooc_max_stack - 1) > 0);
+	}
+	return scene;
+}
+
+//!	function to return a chunk, paging it in if it is not resident.
+std::shared_ptr<const ooc_scene::resident_chunk> ooc_scene::fetch(uint32_t chunk) const
+{
+	std::promise<std::shared_ptr<const resident_chunk>> load;
+	entry e;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		auto found = index.find(chunk);
+		if (found != index.end())
+		{
+			++hits;
+			lru.splice(lru.begin(), lru, found->second);
+			return found->second->second.get();
+		}
+		auto pending = loading.find(chunk);
+		if (pending != loading.end())
+		{
+			// Queue up behind the load already in flight.
+			++hits;
+			e = pending->second;
+		}
+		else
+		{
+			++misses;
+			loading[chunk] = load.get_future().share();
+		}
+	}
+	if (e.valid())
+	{
+		return e.get();
+	}
+
+	// This thread reads the chunk, outside the lock so other chunks keep flowing.
+	const ooc_chunk& c = table[chunk];
+	auto loaded = std::make_shared<resident_chunk>();
+	loaded->nodes.resize(c.node_count);
+	loaded->tris.resize(c.triangle_count);
+	size_t node_bytes = c.node_count * sizeof(ooc_node);
+	size_t tri_bytes = c.triangle_count * sizeof(ooc_triangle);
+	std::memcpy(loaded->nodes.data(), file.data() + c.offset, node_bytes);
+	std::memcpy(loaded->tris.data(), file.data() + c.offset + node_bytes, tri_bytes);
+	loaded->bytes = node_bytes + tri_bytes;
+	file.release(c.offset, node_bytes + tri_bytes);
+
+	std::shared_ptr<const resident_chunk> result = loaded;
+	load.set_value(result);
+	{
+		std::lock_guard<std::mutex> lock(m);
+		auto ready = loading[chunk];
+		loading.erase(chunk);
+		lru.push_front(std::make_pair(chunk, ready));
+		index[chunk] = lru.begin();
+		used += loaded->bytes;
+		while (used > cache_bytes && lru.size() > 1)
+		{
+			used -= lru.back().second.get()->bytes;
+			index.erase(lru.back().first);
+			lru.pop_back();
+			++evictions;
+		}
+		if (used > peak_bytes)
+		{
+			peak_bytes = used;
+		}
+	}
+	return result;
+}
+
+//!	function to return the memory held by resident chunks.
+size_t ooc_scene::resident_bytes() const
+{
+	std::lock_guard<std::mutex> lock(m);
+	return used;
+}
+
+// Slab test against a node box, gives the entry distance.
+inline bool ooc_box_hit(const double lo[3], const double hi[3], const point3& orig, const vec3& inv_dir, double t_min, double t_max, double& t_enter)
+{
+	for (int a = 0; a < 3; ++a)
+	{
+		double t0 = (lo[a] - orig[a]) * inv_dir[a];
+		double t1 = (hi[a] - orig[a]) * inv_dir[a];
+		if (inv_dir[a] < 0)
+		{
+			std::swap(t0, t1);
+		}
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+		if (t_max < t_min)
+		{
+			return false;
+		}
+	}
+	t_enter = t_min;
+	return true;
+}
+
+// Walks nodes from the root, near child first. Calls leaf(first, count) for every leaf
+// the ray reaches before t_max, leaf returns true to stop. leaf may shrink t_max, nodes
+// already pushed are dropped when popped if they now start beyond it, so a chunk behind
+// the closest hit is never paged in.
+template <typename leaf_fn>
+inline bool ooc_walk(const std::vector<ooc_node>& nodes, const ray& r, const vec3& inv_dir, double t_min, double& t_max, leaf_fn leaf)
+{
+	struct entry { uint32_t node; double t_enter; };
+	entry stack[ooc_max_stack];
+	int top = 0;
+	double t_enter;
+	if (nodes.empty() || !ooc_box_hit(nodes[0].lo, nodes[0].hi, r.origin(), inv_dir, t_min, t_max, t_enter))
+	{
+		return false;
+	}
+	stack[top++] = entry{0, t_enter};
+
+	while (top > 0)
+	{
+		entry e = stack[--top];
+		if (e.t_enter > t_max)
+		{
+			continue;
+		}
+		const ooc_node& node = nodes[e.node];
+		if (node.count > 0)
+		{
+			if (leaf(node.index, node.count))
+			{
+				return true;
+			}
+			continue;
+		}
+
+		uint32_t left = static_cast<uint32_t>(&node - nodes.data()) + 1;
+		uint32_t right = node.index;
+		double t_left, t_right;
+		bool hit_left = ooc_box_hit(nodes[left].lo, nodes[left].hi, r.origin(), inv_dir, t_min, t_max, t_left);
+		bool hit_right = ooc_box_hit(nodes[right].lo, nodes[right].hi, r.origin(), inv_dir, t_min, t_max, t_right);
+		if (hit_left && hit_right)
+		{
+			if (t_left > t_right)
+			{
+				std::swap(left, right);
+				std::swap(t_left, t_right);
+			}
+			stack[top++] = entry{right, t_right};
+			stack[top++] = entry{left, t_left};
+		}
+		else if (hit_left)
+		{
+			stack[top++] = entry{left, t_left};
+		}
+		else if (hit_right)
+		{
+			stack[top++] = entry{right, t_right};
+		}
+	}
+	return false;
+}
+
+template <bool any_hit>
+bool ooc_scene::traverse(const ray& r, double t_min, double& t_max, hit_record* rec) const
+{
+	watertight_ray wr(r);
+	vec3 d = r.direction();
+	vec3 inv_dir(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+	bool hit_anything = false;
+
+	ooc_walk(top, r, inv_dir, t_min, t_max, [&](uint32_t first, uint32_t)
+	{
+		auto chunk = fetch(top_order[first]);
+		return ooc_walk(chunk->nodes, r, inv_dir, t_min, t_max, [&](uint32_t tri_first, uint32_t tri_count)
+		{
+			for (uint32_t i = tri_first; i < tri_first + tri_count; ++i)
+			{
+				const ooc_triangle& tri = chunk->tris[i];
+				double t;
+				if (!intersect_triangle(wr, point3(tri.v0[0], tri.v0[1], tri.v0[2]), point3(tri.v1[0], tri.v1[1], tri.v1[2]), point3(tri.v2[0], tri.v2[1], tri.v2[2]), t_min, t_max, t))
+				{
+					continue;
+				}
+				hit_anything = true;
+				if (any_hit)
+				{
+					return true;
+				}
+				t_max = t;
+				rec->t = t;
+				rec->p = r.at(t);
+				rec->set_face_normal(r, vec3(tri.normal[0], tri.normal[1], tri.normal[2]));
+				rec->mat_ptr = materials[tri.material];
+			}
+			return false;
+		});
+	});
+	return hit_anything;
+}
+
+bool ooc_scene::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	bool hit_anything = resident->hit(r, t_min, t_max, rec);
+	if (hit_anything)
+	{
+		t_max = rec.t;
+	}
+	return traverse<false>(r, t_min, t_max, &rec) || hit_anything;
+}
+
+bool ooc_scene::occluded(const ray& r, double t_min, double t_max) const
+{
+	return resident->occluded(r, t_min, t_max) || traverse<true>(r, t_min, t_max, nullptr);
+}
+
+bool ooc_scene::bounding_box(aabb& output_box) const
+{
+	output_box = aabb();
+	for (const auto& chunk : table)
+	{
+		output_box = surrounding_box(output_box, aabb(point3(chunk.lo[0], chunk.lo[1], chunk.lo[2]), point3(chunk.hi[0], chunk.hi[1], chunk.hi[2])));
+	}
+	aabb spheres;
+	if (resident->bounding_box(spheres))
+	{
+		output_box = surrounding_box(output_box, spheres);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include "color.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//!	output_sink struct.
+/*!
+	Where a render job sends its pixels. Rows are delivered exactly once each, in order
+	from the top of the image, with the color sums of samples_per_pixel samples.
+*/
+typedef struct output_sink
+{
+	virtual ~output_sink() {}
+
+	virtual void begin(int image_width, int image_height) = 0;
+	virtual void write_row(int row, const std::vector<color>& pixels, int samples_per_pixel) = 0;
+	virtual void end() = 0;
+} output_sink;
+
+//!	ppm_sink struct.
+/*!
+	Streams the rows as a plain text PPM, either to a file it opens itself or to a stream
+	owned by the caller.
+*/
+typedef struct ppm_sink : output_sink
+{
+	std::ofstream file;
+	std::ostream* out;
+
+	ppm_sink(std::ostream& o) : out(&o) {}
+	ppm_sink(const std::string& path) : file(path), out(&file) {}
+
+	bool good() const
+	{
+		return out->good();
+	}
+
+	virtual void begin(int image_width, int image_height) override
+	{
+		*out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+	}
+
+	virtual void write_row(int /*row*/, const std::vector<color>& pixels, int samples_per_pixel) override
+	{
+		std::ostringstream line;
+		for (const auto& pixel_color : pixels)
+		{
+			write_color(line, pixel_color, samples_per_pixel);
+		}
+		*out << line.str();
+	}
+
+	virtual void end() override
+	{
+		out->flush();
+	}
+} ppm_sink;
+
+//!	image_sink struct.
+/*!
+	Keeps the whole image in memory as averaged linear colors, for callers embedding the
+	renderer that want the pixels rather than a file.
+*/
+typedef struct image_sink : output_sink
+{
+	int width = 0;
+	int height = 0;
+	std::vector<color> pixels;	// row major, row 0 is the top of the image
+
+	virtual void begin(int image_width, int image_height) override
+	{
+		width = image_width;
+		height = image_height;
+		pixels.assign(width * height, color(0, 0, 0));
+	}
+
+	virtual void write_row(int row, const std::vector<color>& row_pixels, int samples_per_pixel) override
+	{
+		for (int i = 0; i < width; ++i)
+		{
+			pixels[row * width + i] = row_pixels[i] / samples_per_pixel;
+		}
+	}
+
+	virtual void end() override {}
+} image_sink;
+
+#endif
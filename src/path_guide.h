@@ -0,0 +1,246 @@
+#ifndef PATH_GUIDE_H
+#define PATH_GUIDE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "radiance_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+//!	path_guide struct.
+/*!
+	Learned incoming light for guiding diffuse bounces, after Vorba et al. and Müller et
+	al.'s practical path guiding but kept simple: a hash grid of cells, the same grid as the
+	radiance cache, each with a histogram over the sphere of directions. The sphere is cut
+	into equal area bins, rows by height and columns by angle around the y axis.
+
+	Training passes record the light each diffuse bounce brought back times the cosine,
+	divided by the pdf it was sampled with, into the bins with atomic adds, so any number of workers can train
+	at once. commit() then turns the histograms into sampling distributions for the next
+	pass, it must only run while no pass is in flight.
+
+	A guided bounce picks the learned distribution with probability guide_fraction and the
+	cosine lobe otherwise, and is weighted by the pdf of the mixture. The cosine lobe keeps
+	every direction the surface reflects into reachable, so the estimate stays unbiased
+	however poor the histogram is. Cells without enough training keep plain BSDF sampling.
+*/
+typedef struct path_guide
+{
+	double spacing;
+	double guide_fraction = 0.5;
+	uint32_t min_samples = 32;	// records before a cell is used
+	std::atomic<bool> learning{false};
+
+	path_guide(double cell_spacing, size_t cells = size_t(1) << 14);
+
+	path_guide(const path_guide&) = delete;
+	path_guide& operator=(const path_guide&) = delete;
+
+	bool steer(const hit_record& rec, ray& scattered, double& pdf, double& weight) const;
+	void record(const hit_record& rec, const vec3& direction, const color& incoming, double pdf);
+	void commit();
+	size_t cells_ready() const;
+
+	private:
+	static const int rows = 8;
+	static const int cols = 16;
+	static const int bins = rows * cols;
+	static const int probes = 8;
+	static constexpr double scale = 1 << 16;	// fixed point scale for the bins
+	static constexpr double max_weight = 1 << 12;
+
+	// Keys are kept apart from the cells so probing reads one cache line, not eight cells.
+	typedef struct cell
+	{
+		std::atomic<uint32_t> count{0};
+		std::atomic<uint64_t> weight[bins];	// fixed point, trained
+		float cdf[bins];			// written by commit()
+		bool ready = false;
+	} cell;
+
+	std::unique_ptr<std::atomic<uint64_t>[]> keys;	// 0 is a free slot
+	std::unique_ptr<cell[]> table;
+	size_t mask;
+
+	cell* find(uint64_t key, bool claim) const;
+	static int bin_of(const vec3& unit_direction);
+	static vec3 sample_bin(int bin);
+	double pdf_of(const cell& c, const vec3& unit_direction) const;
+} path_guide;
+
+path_guide::path_guide(double cell_spacing, size_t cells) : spacing(cell_spacing)
+{
+	size_t size = 1;
+	while (size < cells)
+	{
+		size <<= 1;
+	}
+	keys.reset(new std::atomic<uint64_t>[size]);
+	table.reset(new cell[size]);
+	for (size_t i = 0; i < size; ++i)
+	{
+		keys[i] = 0;
+		for (auto& w : table[i].weight)
+		{
+			w = 0;
+		}
+	}
+	mask = size - 1;
+}
+
+// Linear probing, claiming a free slot when asked to.
+path_guide::cell* path_guide::find(uint64_t key, bool claim) const
+{
+	for (int i = 0; i < probes; ++i)
+	{
+		size_t slot = (key + i) & mask;
+		uint64_t k = keys[slot].load(std::memory_order_acquire);
+		if (k == key)
+		{
+			return &table[slot];
+		}
+		if (k == 0)
+		{
+			if (!claim)
+			{
+				return nullptr;
+			}
+			uint64_t expected = 0;
+			if (keys[slot].compare_exchange_strong(expected, key, std::memory_order_acq_rel) || expected == key)
+			{
+				return &table[slot];
+			}
+		}
+	}
+	return nullptr;
+}
+
+// Equal area bins, uniform in height and in angle around y.
+int path_guide::bin_of(const vec3& d)
+{
+	int row = static_cast<int>((d.y() + 1) * 0.5 * rows);
+	int col = static_cast<int>((std::atan2(d.z(), d.x()) + pi) / (2 * pi) * cols);
+	return std::min(row, rows - 1) * cols + std::min(col, cols - 1);
+}
+
+// Uniform direction inside a bin.
+vec3 path_guide::sample_bin(int bin)
+{
+	int row = bin / cols, col = bin % cols;
+	double y = -1 + 2 * (row + random_double()) / rows;
+	double phi = 2 * pi * (col + random_double()) / cols - pi;
+	double r = std::sqrt(std::fmax(0.0, 1 - y*y));
+	return vec3(r * std::cos(phi), y, r * std::sin(phi));
+}
+
+// Solid angle density of the learned distribution.
+double path_guide::pdf_of(const cell& c, const vec3& d) const
+{
+	int bin = bin_of(d);
+	double p = c.cdf[bin] - (bin > 0 ? c.cdf[bin - 1] : 0.0f);
+	return p * bins / (4 * pi);
+}
+
+//!	function to replace a cosine weighted diffuse bounce with a guided one.
+/*!
+	\param rec hit_record& the diffuse hit.
+	\param scattered ray& the cosine sampled bounce on entry, the guided one on return.
+	\param pdf double& receives the density the bounce was sampled with, for record().
+	\param weight double& receives the factor on top of the albedo, cosine pdf over pdf.
+	\return bool false if the bounce went below the surface and carries no light.
+*/
+bool path_guide::steer(const hit_record& rec, ray& scattered, double& pdf, double& weight) const
+{
+	vec3 d = unit_vector(scattered.direction());
+	const cell* c = find(spatial_key(rec.p, rec.normal, spacing), false);
+	if (!c || !c->ready)
+	{
+		pdf = std::fmax(dot(rec.normal, d), 0.0) / pi;
+		return pdf > 0;
+	}
+
+	if (random_double() < guide_fraction)
+	{
+		double u = random_double();
+		int bin = static_cast<int>(std::upper_bound(c->cdf, c->cdf + bins, static_cast<float>(u)) - c->cdf);
+		d = sample_bin(std::min(bin, bins - 1));
+		scattered = ray(rec.p, d);
+	}
+
+	double cos_theta = dot(rec.normal, d);
+	if (cos_theta <= 0)
+	{
+		return false;
+	}
+	double bsdf_pdf = cos_theta / pi;
+	pdf = guide_fraction * pdf_of(*c, d) + (1 - guide_fraction) * bsdf_pdf;
+	weight = bsdf_pdf / pdf;
+	return true;
+}
+
+//!	function to train the guide with the light one bounce brought back, while learning.
+void path_guide::record(const hit_record& rec, const vec3& direction, const color& incoming, double pdf)
+{
+	if (!learning.load(std::memory_order_relaxed) || pdf <= 0)
+	{
+		return;
+	}
+	cell* c = find(spatial_key(rec.p, rec.normal, spacing), true);
+	if (!c)
+	{
+		return;
+	}
+	// Learn light times cosine, the whole diffuse integrand but the albedo.
+	vec3 d = unit_vector(direction);
+	double lum = 0.2126*incoming.x() + 0.7152*incoming.y() + 0.0722*incoming.z();
+	double w = clamp(lum * std::fmax(dot(rec.normal, d), 0.0) / pdf, 0, max_weight);
+	c->weight[bin_of(d)].fetch_add(static_cast<uint64_t>(w * scale), std::memory_order_relaxed);
+	c->count.fetch_add(1, std::memory_order_relaxed);
+}
+
+//!	function to turn what has been learned so far into sampling distributions.
+void path_guide::commit()
+{
+	for (size_t i = 0; i <= mask; ++i)
+	{
+		cell& c = table[i];
+		if (keys[i] == 0 || c.count < min_samples)
+		{
+			continue;
+		}
+		double total = 0;
+		for (const auto& w : c.weight)
+		{
+			total += static_cast<double>(w);
+		}
+		if (total <= 0)
+		{
+			continue;
+		}
+		double running = 0;
+		for (int b = 0; b < bins; ++b)
+		{
+			running += static_cast<double>(c.weight[b]);
+			c.cdf[b] = static_cast<float>(running / total);
+		}
+		c.cdf[bins - 1] = 1;
+		c.ready = true;
+	}
+}
+
+//!	function to count the cells that guide.
+size_t path_guide::cells_ready() const
+{
+	size_t ready = 0;
+	for (size_t i = 0; i <= mask; ++i)
+	{
+		ready += table[i].ready;
+	}
+	return ready;
+}
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "renderer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//!	framebuffer struct.
+/*!
+	The image a preview hands to its viewer. Always full size, pixels from a reduced
+	resolution pass are repeated over the block they cover. Colors are the linear
+	average of the samples taken so far, gamma is left to whoever displays them.
+*/
+typedef struct framebuffer
+{
+	int width = 0;
+	int height = 0;
+	std::vector<color> pixels;	// row major, row 0 is the top of the image
+	int level = 0;			// resolution divisor of the pass that produced it, 1 is full resolution
+	int samples_per_pixel = 0;
+	unsigned frame = 0;		// increases every time the buffer is republished
+} framebuffer;
+
+//!	preview_settings struct.
+typedef struct preview_settings
+{
+	int image_width = 640;
+	int image_height = 360;
+	int max_depth = 50;
+	int max_samples_per_pixel = 500;	// the preview idles once full resolution reaches this
+	double frame_deadline = 0.1;		// seconds each pass is allowed to take
+} preview_settings;
+
+//!	preview struct.
+/*!
+	A progressive renderer for look-dev. The first pass is taken at 1/8 resolution with a
+	shallow bounce limit so something shows up almost immediately, each following pass
+	doubles the resolution until the full image is reached, after which passes keep
+	accumulating samples. The number of samples per pass is picked from the measured speed
+	of the previous one so each pass lands close to frame_deadline.
+
+	Every finished pass is published to the on_frame callback, and snapshot() lets a viewer
+	poll for the latest one instead. set_camera() cancels the pass in flight, workers check
+	for it between rows, and the preview restarts from the coarsest level.
+*/
+typedef struct preview
+{
+	thread_pool& pool;
+	const hittable& world;
+	preview_settings settings;
+	std::function<void(const framebuffer&)> on_frame;
+
+	preview(thread_pool& p, const hittable& w, preview_settings s, std::function<void(const framebuffer&)> callback = nullptr) : pool(p), world(w), settings(s), on_frame(callback) {}
+	~preview()
+	{
+		stop();
+	}
+
+	void start(const camera& cam);
+	void set_camera(const camera& cam);
+	void stop();
+	bool snapshot(framebuffer& out, unsigned last_frame) const;
+
+	private:
+	std::thread control;
+	camera cam;
+	std::atomic<unsigned> generation{0};	// bumped by every camera change
+	bool quit = false;
+
+	mutable std::mutex m;
+	std::condition_variable cv;
+	framebuffer published;
+
+	void run();
+	bool render_pass(const camera& pass_cam, unsigned gen, int level, int depth, int spp, std::vector<color>& accum);
+} preview;
+
+//!	function to start rendering in the background from the given camera.
+void preview::start(const camera& c)
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		cam = c;
+		quit = false;
+	}
+	control = std::thread(&preview::run, this);
+}
+
+//!	function to move the camera, throwing away any work done for the old one.
+void preview::set_camera(const camera& c)
+{
+	std::lock_guard<std::mutex> lock(m);
+	cam = c;
+	++generation;
+	cv.notify_all();
+}
+
+//!	function to cancel the current pass and join the background thread.
+void preview::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		quit = true;
+		++generation;
+		cv.notify_all();
+	}
+	if (control.joinable())
+	{
+		control.join();
+	}
+}
+
+//!	function for a viewer to poll the latest published frame.
+/*!
+	\param out framebuffer& receives a copy of the frame.
+	\param last_frame unsigned frame number the caller already has.
+	\return bool true if out was updated with a newer frame.
+*/
+bool preview::snapshot(framebuffer& out, unsigned last_frame) const
+{
+	std::lock_guard<std::mutex> lock(m);
+	if (published.frame == last_frame)
+	{
+		return false;
+	}
+	out = published;
+	return true;
+}
+
+void preview::run()
+{
+	const int w = settings.image_width;
+	const int h = settings.image_height;
+
+	while (true)
+	{
+		camera pass_cam;
+		unsigned gen;
+		{
+			std::lock_guard<std::mutex> lock(m);
+			if (quit)
+			{
+				return;
+			}
+			pass_cam = cam;
+			gen = generation;
+		}
+
+		int level = 8;
+		int depth = std::min(4, settings.max_depth);
+		int spp = 1;
+		int accumulated = 0;
+		std::vector<color> accum;
+
+		while (generation == gen)
+		{
+			if (spp < 1)
+			{
+				// Nothing left to add at this level, wait for the camera to move.
+				std::unique_lock<std::mutex> lock(m);
+				cv.wait(lock, [&]{ return generation != gen; });
+				break;
+			}
+
+			int lw = std::max(1, w / level);
+			int lh = std::max(1, h / level);
+			if (static_cast<int>(accum.size()) != lw * lh)
+			{
+				accum.assign(lw * lh, color(0, 0, 0));
+				accumulated = 0;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			if (!render_pass(pass_cam, gen, level, depth, spp, accum))
+			{
+				break;	// camera moved, start over
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			accumulated += spp;
+
+			{
+				std::lock_guard<std::mutex> lock(m);
+				if (generation != gen)
+				{
+					break;
+				}
+				published.width = w;
+				published.height = h;
+				published.pixels.resize(w * h);
+				for (int y = 0; y < h; ++y)
+				{
+					for (int x = 0; x < w; ++x)
+					{
+						int ly = std::min(lh - 1, y / level);
+						int lx = std::min(lw - 1, x / level);
+						published.pixels[y * w + x] = accum[ly * lw + lx] / accumulated;
+					}
+				}
+				published.level = level;
+				published.samples_per_pixel = accumulated;
+				++published.frame;
+			}
+			if (on_frame)
+			{
+				on_frame(published);
+			}
+
+			if (level == 1 && accumulated >= settings.max_samples_per_pixel)
+			{
+				// Converged, wait for the camera to move.
+				std::unique_lock<std::mutex> lock(m);
+				cv.wait(lock, [&]{ return generation != gen; });
+				break;
+			}
+
+			// Time per sample per pixel of this pass, used to size the next one.
+			double cost = seconds / (static_cast<double>(lw) * lh * spp);
+			if (level > 1)
+			{
+				level /= 2;
+				depth = level == 1 ? settings.max_depth : std::min(depth * 2, settings.max_depth);
+				lw = std::max(1, w / level);
+				lh = std::max(1, h / level);
+				// The new level starts from nothing, even when its size happens to match.
+				accum.clear();
+				accumulated = 0;
+			}
+			double budget = settings.frame_deadline / (cost * lw * lh);
+			spp = static_cast<int>(clamp(budget, 1, settings.max_samples_per_pixel - (level == 1 ? accumulated : 0)));
+		}
+	}
+}
+
+//!	function to add spp samples per pixel to accum at 1/level resolution.
+/*!
+	\return bool false if the pass was cancelled by a camera change.
+*/
+bool preview::render_pass(const camera& pass_cam, unsigned gen, int level, int depth, int spp, std::vector<color>& accum)
+{
+	const int lw = std::max(1, settings.image_width / level);
+	const int lh = std::max(1, settings.image_height / level);
+	std::atomic<int> next_row(0);
+
+	auto work = [&]()
+	{
+		for (int row = next_row++; row < lh; row = next_row++)
+		{
+			if (generation != gen)
+			{
+				return;
+			}
+			int j = lh - 1 - row;
+			for (int i = 0; i < lw; ++i)
+			{
+				color pixel_color(0, 0, 0);
+				for (int s = 0; s < spp; ++s)
+				{
+					auto u = (i + random_double()) / std::max(1, lw - 1);
+					auto v = (j + random_double()) / std::max(1, lh - 1);
+					pixel_color += ray_color(pass_cam.get_ray(u, v), world, depth);
+				}
+				accum[row * lw + i] += pixel_color;
+			}
+		}
+	};
+
+	pool.parallel(work);
+
+	return generation == gen;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "rtweekend.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+//!	function to hash the grid cell of p and the dominant signed axis of normal, never 0.
+inline uint64_t spatial_key(const point3& p, const vec3& normal, double spacing)
+{
+	uint64_t key = 0;
+	for (int k = 0; k < 3; ++k)
+	{
+		auto q = static_cast<int64_t>(std::floor(p[k] / spacing));
+		key = key * 0x9e3779b97f4a7c15ull ^ static_cast<uint64_t>(q & 0x1fffff);
+	}
+	vec3 a(std::fabs(normal.x()), std::fabs(normal.y()), std::fabs(normal.z()));
+	int axis = a.x() > a.y() ? (a.x() > a.z() ? 0 : 2) : (a.y() > a.z() ? 1 : 2);
+	key = key * 0x9e3779b97f4a7c15ull ^ static_cast<uint64_t>(2 * axis + (normal[axis] < 0));
+	key ^= key >> 29;
+	return key | 1;
+}
+
+//!	radiance_cache struct.
+/*!
+	Cached incoming radiance at diffuse surfaces, in a hash grid of cells spacing wide keyed
+	on the cell and the dominant axis of the normal. Every thread adds its samples with
+	atomic adds and claims empty slots with a compare and swap, there are no locks.
+
+	A cell answers lookups once it holds min_samples and the standard error of its mean
+	luminance is below max_error times that mean, otherwise the caller traces the path and
+	adds the result. Lookups are jittered by up to half a cell on each axis, which blends
+	neighbouring cells on average instead of showing the grid. Cells stop taking samples
+	after max_samples, so a converged cell is only read.
+
+	The cached value stands in for everything behind the hit, so a smaller spacing and a
+	smaller max_error both trade speed for less bias.
+*/
+typedef struct radiance_cache
+{
+	double spacing;
+	double max_error;
+	uint32_t min_samples = 16;
+	uint32_t max_samples = 1024;
+
+	std::atomic<size_t> lookups{0}, answered{0};
+
+	radiance_cache(double cell_spacing, double error, size_t cells = size_t(1) << 20);
+
+	radiance_cache(const radiance_cache&) = delete;
+	radiance_cache& operator=(const radiance_cache&) = delete;
+
+	bool lookup(const point3& p, const vec3& normal, color& radiance);
+	void add(const point3& p, const vec3& normal, const color& radiance);
+	size_t cells_used() const;
+
+	private:
+	typedef struct cell
+	{
+		std::atomic<uint64_t> key{0};	// 0 is a free slot
+		std::atomic<uint32_t> count{0};
+		std::atomic<uint64_t> sum[3];	// fixed point radiance sums
+		std::atomic<uint64_t> sum_sq{0};	// fixed point luminance squared sum
+	} cell;
+
+	static const int probes = 8;
+	static constexpr double scale = 1 << 20;	// fixed point scale for the sums
+	static constexpr double max_radiance = 1 << 10;
+
+	std::unique_ptr<cell[]> table;
+	size_t mask;
+
+	uint64_t key_of(const point3& p, const vec3& normal) const;
+	cell* find(uint64_t key, bool claim);
+} radiance_cache;
+
+radiance_cache::radiance_cache(double cell_spacing, double error, size_t cells) : spacing(cell_spacing), max_error(error)
+{
+	size_t size = 1;
+	while (size < cells)
+	{
+		size <<= 1;
+	}
+	table.reset(new cell[size]);
+	for (size_t i = 0; i < size; ++i)
+	{
+		for (auto& s : table[i].sum)
+		{
+			s = 0;
+		}
+	}
+	mask = size - 1;
+}
+
+uint64_t radiance_cache::key_of(const point3& p, const vec3& normal) const
+{
+	return spatial_key(p, normal, spacing);
+}
+
+// Linear probing, claiming a free slot when asked to.
+radiance_cache::cell* radiance_cache::find(uint64_t key, bool claim)
+{
+	for (int i = 0; i < probes; ++i)
+	{
+		cell& c = table[(key + i) & mask];
+		uint64_t k = c.key.load(std::memory_order_acquire);
+		if (k == key)
+		{
+			return &c;
+		}
+		if (k == 0)
+		{
+			if (!claim)
+			{
+				return nullptr;
+			}
+			uint64_t expected = 0;
+			if (c.key.compare_exchange_strong(expected, key, std::memory_order_acq_rel) || expected == key)
+			{
+				return &c;
+			}
+		}
+	}
+	return nullptr;	// neighbourhood full, this point goes uncached
+}
+
+//!	function to look up the cached radiance around a point.
+/*!
+	\param p point3& the hit point.
+	\param normal vec3& the surface normal at p.
+	\param radiance color& receives the mean incoming radiance of the cell.
+	\return bool true if the cell is within the error bound.
+*/
+bool radiance_cache::lookup(const point3& p, const vec3& normal, color& radiance)
+{
+	++lookups;
+	point3 jittered = p + spacing * vec3(random_double() - 0.5, random_double() - 0.5, random_double() - 0.5);
+	cell* c = find(key_of(jittered, normal), false);
+	if (!c)
+	{
+		return false;
+	}
+
+	uint32_t n = c->count.load(std::memory_order_relaxed);
+	if (n < min_samples)
+	{
+		return false;
+	}
+	color mean(c->sum[0] / scale / n, c->sum[1] / scale / n, c->sum[2] / scale / n);
+	double lum = 0.2126*mean.x() + 0.7152*mean.y() + 0.0722*mean.z();
+	double variance = std::fmax(c->sum_sq / scale / n - lum*lum, 0.0);
+	if (std::sqrt(variance / n) > max_error * lum)
+	{
+		return false;
+	}
+	++answered;
+	radiance = mean;
+	return true;
+}
+
+//!	function to add one traced sample of the incoming radiance at a point.
+void radiance_cache::add(const point3& p, const vec3& normal, const color& radiance)
+{
+	cell* c = find(key_of(p, normal), true);
+	if (!c || c->count.load(std::memory_order_relaxed) >= max_samples)
+	{
+		return;
+	}
+
+	color clamped(clamp(radiance.x(), 0, max_radiance), clamp(radiance.y(), 0, max_radiance), clamp(radiance.z(), 0, max_radiance));
+	double lum = 0.2126*clamped.x() + 0.7152*clamped.y() + 0.0722*clamped.z();
+	for (int k = 0; k < 3; ++k)
+	{
+		c->sum[k].fetch_add(static_cast<uint64_t>(clamped[k] * scale), std::memory_order_relaxed);
+	}
+	c->sum_sq.fetch_add(static_cast<uint64_t>(lum * lum * scale), std::memory_order_relaxed);
+	c->count.fetch_add(1, std::memory_order_relaxed);
+}
+
+//!	function to count the occupied cells.
+size_t radiance_cache::cells_used() const
+{
+	size_t used = 0;
+	for (size_t i = 0; i <= mask; ++i)
+	{
+		used += table[i].key.load(std::memory_order_relaxed) != 0;
+	}
+	return used;
+}
+
+#endif
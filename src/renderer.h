@@ -0,0 +1,502 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "material.h"
+#include "output_sink.h"
+#include "path_guide.h"
+#include "radiance_cache.h"
+#include "row_writer.h"
+#include "sampling.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//!	function to return the sky seen along a ray that hit nothing.
+inline color background(const ray& r)
+{
+	vec3 unit_direction = unit_vector(r.direction());
+	auto t = 0.5*(unit_direction.y() + 1.0);
+	return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+//	return (1.0-t)*color(0.5, 0.7, 1.0) + t*color(0, 0, 0);
+}
+
+//!	function to key a ray for coherent ordering.
+/*!
+	The octant of the direction sits above a 27 bit Morton code of where the origin falls
+	inside bounds, so sorting on the key groups rays heading the same way and then walks
+	their origins along a space filling curve.
+	\param r ray& the ray.
+	\param bounds aabb& the box the origins are quantised in, usually the scene's.
+	\return uint32_t the key.
+*/
+inline uint32_t coherence_key(const ray& r, const aabb& bounds)
+{
+	uint32_t key = 0;
+	for (int k = 0; k < 3; ++k)
+	{
+		double extent = bounds.max()[k] - bounds.min()[k];
+		double u = extent > 0 ? (r.origin()[k] - bounds.min()[k]) / extent : 0;
+		key |= morton_spread(static_cast<uint32_t>(clamp(u, 0, 1) * 511)) << k;
+		key |= static_cast<uint32_t>(r.direction()[k] < 0) << (27 + k);
+	}
+	return key;
+}
+
+//!	function to find the order that sorts a batch of rays by coherence_key().
+/*!
+	\param rays ray* the batch.
+	\param count size_t rays in the batch.
+	\param bounds aabb& the box the origins are quantised in.
+	\param order std::vector<uint64_t>& receives the key above the index of each ray, in sorted
+	order, so the low 32 bits give the permutation.
+*/
+void coherence_order(const ray* rays, size_t count, const aabb& bounds, std::vector<uint64_t>& order)
+{
+	order.resize(count);
+	for (size_t k = 0; k < count; ++k)
+	{
+		order[k] = static_cast<uint64_t>(coherence_key(rays[k], bounds)) << 32 | k;
+	}
+	std::sort(order.begin(), order.end());
+}
+
+//!	function to rearrange v into the order found by coherence_order().
+template <typename T>
+void apply_order(std::vector<T>& v, const std::vector<uint64_t>& order, std::vector<T>& scratch)
+{
+	scratch.resize(order.size());
+	for (size_t k = 0; k < order.size(); ++k)
+	{
+		scratch[k] = v[static_cast<uint32_t>(order[k])];
+	}
+	v.swap(scratch);
+}
+
+//! A function that takes in two arguments, returns a color object.
+/*! 
+  \param r ray&, casted ray for drawing the scene.
+  \param world hittable&, hittable object representing objects in the world.
+  \param cache radiance_cache*, optional, answers for diffuse hits of all but the camera rays.
+  \param guide path_guide*, optional, steers diffuse bounces and learns while it is training.
+  \param primary bool, true for the ray leaving the camera.
+  \return The color of the pixel to be drawn in the scene.
+ */
+color ray_color(const ray& r, const hittable& world, int depth, radiance_cache* cache = nullptr, path_guide* guide = nullptr, bool primary = true)
+{
+	hit_record rec;
+	
+	// If we've exceeded the ray bounce limit, no more light is gathered.
+	if (depth <= 0)
+	{
+		return color(0,0,0);
+	}
+
+	if (world.hit(r, 0.001, infinity, rec))
+	{
+		// TODO: allow of toggling of different diffuse methods?
+//		point3 target = rec.p + rec.nomral + random_in_unit_sphere();	// Aproximation of Lambertian diffuse
+//		point3 target = rec.p + rec.normal + random_unit_vector();	// Lambertian diffuse
+//		point3 target = rec.p + random_in_hemisphere(rec.normal);	// Hemispherical scattering
+//		return 0.5 * ray_color(ray(rec.p, target - rec.p), world, depth-1);
+		ray scattered;
+		color attenuation;
+		if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+		{
+			bool diffuse = rec.mat_ptr->diffuse();
+			bool cached = cache && !primary && diffuse;
+			double pdf = 0, weight = 1;
+			if (guide && diffuse && !guide->steer(rec, scattered, pdf, weight))
+			{
+				return color(0,0,0);
+			}
+
+			// The cache holds weighted samples, so it averages to the same light guided or not.
+			color incoming;
+			if (!cached || !cache->lookup(rec.p, rec.normal, incoming))
+			{
+				color traced = ray_color(scattered, world, depth-1, cache, guide, false);
+				if (pdf > 0)
+				{
+					guide->record(rec, scattered.direction(), traced, pdf);
+				}
+				incoming = weight * traced;
+				if (cached)
+				{
+					cache->add(rec.p, rec.normal, incoming);
+				}
+			}
+			return attenuation * incoming;
+		}
+		return color(0,0,0);
+	}
+	return background(r);
+}
+
+//!	render_settings struct.
+typedef struct render_settings
+{
+	int image_width = 640;
+	int image_height = 360;
+	int samples_per_pixel = 500;
+	int max_depth = 50;
+	int window = 0;	// rows allowed in flight ahead of the output, 0 picks 4 per pool thread
+	std::shared_ptr<radiance_cache> cache;	// optional, shared by every row
+	std::shared_ptr<path_guide> guide;	// optional, trained with train_guide() first
+	bool stream = false;	// trace rows breadth first through hittable::hit_stream(), no cache or guide
+	int stream_batch = 4096;	// paths per stream batch
+	bool sort_rays = false;	// sort stream bounces with coherence_order() before tracing them
+} render_settings;
+
+//!	function to render one scanline a bounce at a time over a batch of paths.
+/*!
+	The same estimate as render_row(), but breadth first: a batch of samples of the row is
+	traced together through hittable::hit_stream(), shaded, and the survivors traced again,
+	so the structure sees many independent rays at once and can overlap their cache misses.
+	Paths are compacted after every bounce, and the camera ray samples of a batch are
+	drawn together with the batched samplers of sampling.h. The radiance cache and path
+	guide need the recursive form and are not used here.
+
+	With sort_rays the bounces after the camera rays are sorted by coherence_key() before
+	they are traced, so neighbouring rays in the batch visit the same nodes and triangles
+	while they are still in cache. The results land back on their paths through pixel_of,
+	which is sorted along with them.
+*/
+bool render_row_stream(const camera& cam, const hittable& world, const render_settings& settings, int row, std::vector<color>& pixels, const std::atomic<bool>* cancel)
+{
+	const int image_width = settings.image_width;
+	const int image_height = settings.image_height;
+	const int batch_spp = std::max(1, settings.stream_batch / image_width);
+	int j = image_height - 1 - row;
+
+	std::vector<ray> rays;
+	std::vector<int> pixel_of;
+	std::vector<color> throughput;
+	std::vector<hit_record> recs;
+	std::unique_ptr<bool[]> hits(new bool[static_cast<size_t>(image_width) * batch_spp]);
+
+	// Camera ray samples for a whole batch at once: pixel jitter and lens points.
+	const int batch_size = image_width * batch_spp;
+	std::vector<double> jitter_u(batch_size), jitter_v(batch_size), lens_x(batch_size), lens_y(batch_size);
+
+	std::vector<uint64_t> order;
+	std::vector<ray> ray_scratch;
+	std::vector<int> pixel_scratch;
+	std::vector<color> throughput_scratch;
+	aabb bounds;
+	bool sorting = settings.sort_rays && world.bounding_box(bounds);
+
+	pixels.assign(image_width, color(0, 0, 0));
+	for (int first = 0; first < settings.samples_per_pixel; first += batch_spp)
+	{
+		if (cancel && *cancel)
+		{
+			return false;
+		}
+
+		rays.clear();
+		pixel_of.clear();
+		throughput.clear();
+		random_doubles(batch_size, jitter_u.data());
+		random_doubles(batch_size, jitter_v.data());
+		random_in_unit_disks(batch_size, lens_x.data(), lens_y.data());
+		for (int i = 0; i < image_width; ++i)
+		{
+			for (int s = first; s < std::min(first + batch_spp, settings.samples_per_pixel); ++s)
+			{
+				size_t k = rays.size();
+				auto u = (i + jitter_u[k]) / (image_width-1);
+				auto v = (j + jitter_v[k]) / (image_height-1);
+				rays.push_back(cam.get_ray(u, v, lens_x[k], lens_y[k]));
+				pixel_of.push_back(i);
+				throughput.push_back(color(1, 1, 1));
+			}
+		}
+
+		for (int depth = 0; depth < settings.max_depth && !rays.empty(); ++depth)
+		{
+			recs.resize(rays.size());
+			world.hit_stream(rays.data(), rays.size(), 0.001, infinity, recs.data(), hits.get());
+
+			size_t alive = 0;
+			for (size_t k = 0; k < rays.size(); ++k)
+			{
+				if (!hits[k])
+				{
+					pixels[pixel_of[k]] += throughput[k] * background(rays[k]);
+					continue;
+				}
+				ray scattered;
+				color attenuation;
+				if (recs[k].mat_ptr->scatter(rays[k], recs[k], attenuation, scattered))
+				{
+					rays[alive] = scattered;
+					pixel_of[alive] = pixel_of[k];
+					throughput[alive] = throughput[k] * attenuation;
+					++alive;
+				}
+			}
+			rays.resize(alive);
+			pixel_of.resize(alive);
+			throughput.resize(alive);
+
+			if (sorting && alive > 1 && depth + 1 < settings.max_depth)
+			{
+				coherence_order(rays.data(), alive, bounds, order);
+				apply_order(rays, order, ray_scratch);
+				apply_order(pixel_of, order, pixel_scratch);
+				apply_order(throughput, order, throughput_scratch);
+			}
+		}
+	}
+	return true;
+}
+
+//!	function to render one scanline.
+/*!
+	\param cam camera& the camera to shoot rays from.
+	\param world hittable& the scene.
+	\param settings render_settings& resolution, samples and bounce limit.
+	\param row int the scanline, 0 being the top of the image.
+	\param pixels std::vector<color>& receives the color sums of the row.
+	\param cancel std::atomic<bool>* optional flag checked between pixels.
+	\return bool false if the row was abandoned because cancel was raised.
+*/
+bool render_row(const camera& cam, const hittable& world, const render_settings& settings, int row, std::vector<color>& pixels, const std::atomic<bool>* cancel = nullptr)
+{
+	if (settings.stream)
+	{
+		return render_row_stream(cam, world, settings, row, pixels, cancel);
+	}
+
+	const int image_width = settings.image_width;
+	const int image_height = settings.image_height;
+	int j = image_height - 1 - row;
+
+	pixels.assign(image_width, color(0, 0, 0));
+	for (int i = 0; i < image_width; ++i)
+	{
+		if (cancel && *cancel)
+		{
+			return false;
+		}
+		color pixel_color(0, 0, 0);
+		for (int s = 0; s < settings.samples_per_pixel; ++s)
+		{
+			auto u = (i + random_double()) / (image_width-1);
+			auto v = (j + random_double()) / (image_height-1);
+			ray r = cam.get_ray(u, v);
+			pixel_color += ray_color(r, world, settings.max_depth, settings.cache.get(), settings.guide.get());
+		}
+		pixels[i] = pixel_color;
+	}
+	return true;
+}
+
+//!	render_job struct.
+/*!
+	One image being rendered asynchronously on a shared thread_pool. Create it with
+	render_job::launch(), which queues the first rows and returns right away. Rows go to the
+	pool as separate tasks, only as many as fit in the output's reorder window are queued at
+	once, so several jobs sharing a pool interleave instead of running one after the other.
+
+	The job keeps the scene and sink alive until it has finished. The future resolves to
+	true once every row has reached the sink, or false if the job was cancelled, in which
+	case the sink's end() is still called but the image is incomplete.
+*/
+typedef struct render_job : std::enable_shared_from_this<render_job>
+{
+	std::shared_ptr<const hittable> world;
+	camera cam;
+	render_settings settings;
+	std::shared_ptr<output_sink> sink;
+
+	static std::shared_ptr<render_job> launch(thread_pool& pool, std::shared_ptr<const hittable> world, const camera& cam, const render_settings& settings, std::shared_ptr<output_sink> sink);
+
+	std::shared_future<bool> future() const
+	{
+		return done;
+	}
+	bool wait()
+	{
+		return done.get();
+	}
+	void cancel()
+	{
+		cancelled = true;
+	}
+	bool is_cancelled() const
+	{
+		return cancelled;
+	}
+	double progress() const
+	{
+		return static_cast<double>(rows_done) / settings.image_height;
+	}
+
+	private:
+	render_job(thread_pool& p, std::shared_ptr<const hittable> w, const camera& c, const render_settings& s, std::shared_ptr<output_sink> o);
+
+	thread_pool& pool;
+	std::unique_ptr<row_writer> writer;
+	std::promise<bool> result;
+	std::shared_future<bool> done;
+	std::atomic<bool> cancelled{false};
+	std::atomic<int> rows_done{0};
+
+	std::mutex m;
+	int next_issue = 0;	// next row to hand to the pool
+	int in_flight = 0;	// rows queued or being rendered
+	bool finished = false;
+
+	void issue();
+	void run_row(int row);
+	void finish();
+} render_job;
+
+render_job::render_job(thread_pool& p, std::shared_ptr<const hittable> w, const camera& c, const render_settings& s, std::shared_ptr<output_sink> o) : world(w), cam(c), settings(s), sink(o), pool(p)
+{
+	if (settings.window <= 0)
+	{
+		settings.window = 4 * static_cast<int>(pool.size());
+	}
+	writer.reset(new row_writer(*sink, settings.image_height, settings.window, settings.samples_per_pixel));
+	done = result.get_future().share();
+}
+
+//!	function to start a render job.
+/*!
+	\param pool thread_pool& the pool the rows will run on.
+	\param world shared_ptr<const hittable> the scene, shared so several jobs can use one build.
+	\param cam camera& the camera.
+	\param settings render_settings& resolution, samples and bounce limit.
+	\param sink shared_ptr<output_sink> where the finished rows go.
+	\return shared_ptr<render_job> handle to wait on, cancel or poll.
+*/
+std::shared_ptr<render_job> render_job::launch(thread_pool& pool, std::shared_ptr<const hittable> world, const camera& cam, const render_settings& settings, std::shared_ptr<output_sink> sink)
+{
+	std::shared_ptr<render_job> job(new render_job(pool, world, cam, settings, sink));
+	job->sink->begin(settings.image_width, settings.image_height);
+	job->issue();
+	return job;
+}
+
+// Queues as many rows as fit in the window past the last written row.
+void render_job::issue()
+{
+	int limit = std::min(settings.image_height, writer->written() + settings.window);
+
+	std::lock_guard<std::mutex> lock(m);
+	if (cancelled)
+	{
+		limit = next_issue;
+	}
+	for (; next_issue < limit; ++next_issue)
+	{
+		++in_flight;
+		auto self = shared_from_this();
+		int row = next_issue;
+		pool.submit([self, row]{ self->run_row(row); });
+	}
+
+	if (in_flight == 0 && (cancelled || next_issue == settings.image_height))
+	{
+		finish();
+	}
+}
+
+void render_job::run_row(int row)
+{
+	std::vector<color> pixels;
+	if (!cancelled && render_row(cam, *world, settings, row, pixels, &cancelled))
+	{
+		writer->submit(row, std::move(pixels));
+		++rows_done;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m);
+		--in_flight;
+	}
+	issue();
+}
+
+// Called with m held, once nothing is left in flight.
+void render_job::finish()
+{
+	if (finished)
+	{
+		return;
+	}
+	finished = true;
+
+	bool complete = !cancelled;
+	if (complete)
+	{
+		writer->wait();
+	}
+	sink->end();
+	result.set_value(complete);
+}
+
+//!	function to render several views of one scene at once.
+/*!
+	Every view is its own render_job on the one pool and scene build. A job only keeps its
+	window of rows queued and queues the next row behind everything else when one finishes,
+	so the rows of all views interleave in the pool's single queue and the cores stay busy
+	until the last view is done. With the default window each view gets its share of the
+	rows one job would keep in flight, at least two.
+	\param cams std::vector<camera>& one camera per view.
+	\param sinks std::vector<shared_ptr<output_sink>>& one output per view, same order.
+	\return std::vector<shared_ptr<render_job>> the jobs, in view order.
+*/
+std::vector<std::shared_ptr<render_job>> render_views(thread_pool& pool, std::shared_ptr<const hittable> world, const std::vector<camera>& cams, const render_settings& settings, const std::vector<std::shared_ptr<output_sink>>& sinks)
+{
+	render_settings view_settings = settings;
+	if (view_settings.window <= 0 && !cams.empty())
+	{
+		int views = static_cast<int>(cams.size());
+		view_settings.window = std::max(2, (4 * static_cast<int>(pool.size()) + views - 1) / views);
+	}
+
+	std::vector<std::shared_ptr<render_job>> jobs;
+	for (size_t i = 0; i < cams.size() && i < sinks.size(); ++i)
+	{
+		jobs.push_back(render_job::launch(pool, world, cams[i], view_settings, sinks[i]));
+	}
+	return jobs;
+}
+
+//!	function to train settings.guide before the actual render.
+/*!
+	Renders passes of 1, 2, 4 and so on samples per pixel, each guided by what the passes
+	before it learned, and throws the images away. Every pass runs over the whole pool.
+	\param passes int number of training passes.
+*/
+void train_guide(thread_pool& pool, std::shared_ptr<const hittable> world, const camera& cam, const render_settings& settings, int passes)
+{
+	if (!settings.guide)
+	{
+		return;
+	}
+	render_settings pass = settings;
+	pass.window = 0;
+	settings.guide->learning = true;
+	for (int i = 0; i < passes; ++i)
+	{
+		pass.samples_per_pixel = 1 << i;
+		render_job::launch(pool, world, cam, pass, std::make_shared<image_sink>())->wait();
+		settings.guide->commit();
+	}
+	settings.guide->learning = false;
+}
+
+#endif
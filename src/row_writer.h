@@ -0,0 +1,90 @@
+#ifndef ROW_WRITER_H
+#define ROW_WRITER_H
+
+#include "output_sink.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+//!	row_writer struct.
+/*!
+	Streams finished scanlines to an output sink in image order. Rows may be finished
+	out of order by different threads, they are parked in a fixed-size reorder window
+	until every row above them has been written. Whoever hands out rows must only issue
+	rows below written() + window, so at most window rows are ever held in memory
+	regardless of resolution.
+*/
+typedef struct row_writer
+{
+	output_sink& sink;
+	int image_height;
+	int window;
+	int samples_per_pixel;
+
+	std::vector<std::vector<color>> slots;	// slots[row % window] holds a finished row
+	std::vector<bool> ready;
+	int next_row;				// next row (0 = top) to be written to the sink
+	bool flushing;
+
+	std::mutex m;
+	std::condition_variable cv;
+
+	row_writer(output_sink& s, int height, int w, int spp) : sink(s), image_height(height), window(w), samples_per_pixel(spp), slots(w), ready(w, false), next_row(0), flushing(false) {}
+
+	void submit(int row, std::vector<color>&& pixels);
+	int written();
+	void wait();
+} row_writer;
+
+//!	function to hand over a finished row, writing it and any rows queued behind it once it is next in line.
+/*!
+	\param row int index of the finished row, must fit inside the window.
+	\param pixels std::vector<color>&& the color sums of the row.
+*/
+void row_writer::submit(int row, std::vector<color>&& pixels)
+{
+	std::unique_lock<std::mutex> lock(m);
+	slots[row % window] = std::move(pixels);
+	ready[row % window] = true;
+
+	// Only one thread drains the window at a time, the others go back to rendering.
+	if (flushing || row != next_row)
+	{
+		return;
+	}
+	flushing = true;
+
+	while (next_row < image_height && ready[next_row % window])
+	{
+		std::vector<color> line = std::move(slots[next_row % window]);
+		slots[next_row % window] = std::vector<color>();
+		ready[next_row % window] = false;
+
+		// Do the I/O without holding the lock so other rows can keep being submitted.
+		lock.unlock();
+		sink.write_row(next_row, line, samples_per_pixel);
+		lock.lock();
+
+		++next_row;
+		cv.notify_all();
+	}
+
+	flushing = false;
+}
+
+//!	function to return how many rows have been written so far.
+int row_writer::written()
+{
+	std::lock_guard<std::mutex> lock(m);
+	return next_row;
+}
+
+//!	function to block until every row has been written.
+void row_writer::wait()
+{
+	std::unique_lock<std::mutex> lock(m);
+	cv.wait(lock, [&]{ return next_row >= image_height; });
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef RTWEEKEND_H
 #define RTWEEKEND_H
 
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
 #include <cmath>
 #include <limits>
@@ -18,10 +20,37 @@ inline double degrees_to_radians(double degrees)
 	return degrees * pi / 180.0;
 }
 
+inline uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+inline uint64_t& random_state()
+{
+	// Every thread gets its own generator, so render threads never fight over one shared
+	// state, and the order threads start in decides their streams.
+	static std::atomic<uint64_t> streams(0);
+	thread_local uint64_t state = splitmix64(++streams) | 1;
+	return state;
+}
+
+inline void seed_random(uint64_t seed)
+{
+	// Makes what the calling thread draws next repeatable, e.g. to build the same scene twice.
+	random_state() = splitmix64(seed) | 1;
+}
+
 inline double random_double()
 {
-	// Returns a random real in [0,1).
-	return rand() / (RAND_MAX + 1.0);
+	// Returns a random real in [0,1), xorshift64* keeping the top 53 bits.
+	uint64_t& x = random_state();
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	return ((x * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max)
@@ -43,6 +72,17 @@ inline double clamp(double x, double min, double max)
 	return x;
 }
 
+// Spreads the low 10 bits of v out to every third bit.
+inline uint32_t morton_spread(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
 // Common Headers
 
 #include "ray.h"
@@ -0,0 +1,133 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+// Batched versions of the samplers in vec3.h and onb.h.
+//
+// The random numbers are drawn first, then turned into samples by a loop with no
+// branches, which the compiler can vectorize. main --sampler-bench compares them with
+// the one at a time versions.
+// Output is structure of arrays, n values each in x, y and z.
+
+const int sample_batch = 64;
+
+//!	function to fill arrays with uniform random numbers in [0,1).
+/*!
+	\param n int number of values.
+	\param u double* output array.
+*/
+inline void random_doubles(int n, double* u)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		u[i] = random_double();
+	}
+}
+
+//!	function to generate n random unit vectors uniformly distributed over the sphere.
+void random_unit_vectors(int n, double* x, double* y, double* z)
+{
+	double u1[sample_batch], u2[sample_batch];
+
+	for (int base = 0; base < n; base += sample_batch)
+	{
+		int count = std::min(sample_batch, n - base);
+		random_doubles(count, u1);
+		random_doubles(count, u2);
+
+		for (int i = 0; i < count; ++i)
+		{
+			auto zi = 1 - 2*u1[i];
+			auto phi = 2*pi*u2[i];
+			auto r = std::sqrt(std::fmax(0.0, 1 - zi*zi));
+			x[base + i] = r*std::cos(phi);
+			y[base + i] = r*std::sin(phi);
+			z[base + i] = zi;
+		}
+	}
+}
+
+//!	function to generate n cosine weighted directions in the hemisphere around +z.
+void random_cosine_directions(int n, double* x, double* y, double* z)
+{
+	double u1[sample_batch], u2[sample_batch];
+
+	for (int base = 0; base < n; base += sample_batch)
+	{
+		int count = std::min(sample_batch, n - base);
+		random_doubles(count, u1);
+		random_doubles(count, u2);
+
+		for (int i = 0; i < count; ++i)
+		{
+			auto phi = 2*pi*u1[i];
+			auto r = std::sqrt(u2[i]);
+			x[base + i] = r*std::cos(phi);
+			y[base + i] = r*std::sin(phi);
+			z[base + i] = std::sqrt(1 - u2[i]);
+		}
+	}
+}
+
+//!	function to generate n points in the unit disk, z is left untouched.
+/*!
+	Points are drawn in the square and kept when they fall inside the disk, the keep
+	being a store that always happens plus an index that only moves on a hit, so there is
+	no branch to mispredict. Cheaper than any closed form mapping since it needs no trig.
+*/
+void random_in_unit_disks(int n, double* x, double* y)
+{
+	double u1[sample_batch], u2[sample_batch];
+
+	for (int made = 0; made < n; )
+	{
+		// At most as many candidates as points still missing, so the stores stay in bounds.
+		int count = std::min(sample_batch, n - made);
+		random_doubles(count, u1);
+		random_doubles(count, u2);
+
+		for (int i = 0; i < count; ++i)
+		{
+			auto a = 2*u1[i] - 1;
+			auto b = 2*u2[i] - 1;
+			x[made] = a;
+			y[made] = b;
+			made += a*a + b*b < 1;
+		}
+	}
+}
+
+//!	function to generate n points in the unit disk with the concentric mapping, z is left untouched.
+/*!
+	The closed form alternative to random_in_unit_disks(), one point per pair of random
+	numbers but a cos and sin each. Not used for rendering, kept so --sampler-bench can
+	compare the two.
+*/
+void random_in_unit_disks_concentric(int n, double* x, double* y)
+{
+	double u1[sample_batch], u2[sample_batch];
+
+	for (int base = 0; base < n; base += sample_batch)
+	{
+		int count = std::min(sample_batch, n - base);
+		random_doubles(count, u1);
+		random_doubles(count, u2);
+
+		for (int i = 0; i < count; ++i)
+		{
+			auto a = 2*u1[i] - 1;
+			auto b = 2*u2[i] - 1;
+			bool wide = std::fabs(a) > std::fabs(b);
+			auto r = wide ? a : b;
+			auto ratio = (wide ? b : a) / (r + (r == 0));
+			auto phi = wide ? (pi/4) * ratio : (pi/2) - (pi/4) * ratio;
+			x[base + i] = r*std::cos(phi);
+			y[base + i] = r*std::sin(phi);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <string>
+
+hittable_list cover_scene()
+{
+	hittable_list world;
+
+	auto ground_material = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+	for (int a = -11; a < 11; a++)
+	{
+		for (int b = -11; b < 11; b++)
+		{
+			auto choose_mat = random_double();
+			point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+			if ((center - point3(3, 0.2, 0)).length() > 0.9)
+			{
+				std::shared_ptr<material> sphere_material;
+
+				if (choose_mat < 0.8)
+				{
+					// diffuse
+					auto albedo = random_vec3() * random_vec3();
+					sphere_material = std::make_shared<lambertian>(albedo);
+					world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+				}
+				else if (choose_mat < 0.95)
+				{
+					// metal
+					auto albedo = random_vec3(0.5, 1); 
+					auto fuzz = random_double(0, 0.5);
+					sphere_material = std::make_shared<metal>(albedo, fuzz);
+					world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+				}
+				else
+				{
+					// glass
+					sphere_material = std::make_shared<dielectric>(1.5);
+					world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+				}
+			}
+		}
+	}
+
+	auto material1 = std::make_shared<dielectric>(1.5);
+	world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+	auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
+	world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+	auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+	world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+	return world;
+}
+
+hittable_list my_scene()
+{
+	hittable_list world;
+
+ 	auto material_ground = std::make_shared<lambertian>(color(0.11, 0.21, 0.18));
+	auto material_center = std::make_shared<dielectric>(1.5);
+	auto material_water = std::make_shared<dielectric>(1.333);
+	auto material_left   = std::make_shared<dielectric>(1.7);
+	auto material_right  = std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.1);
+	
+	world.add(std::make_shared<sphere>(point3( 0.5,   0.0, -1),   0.5,     material_right));
+	world.add(std::make_shared<sphere>(point3( 0.0, -0.25, -0),  0.25,     material_center));
+	world.add(std::make_shared<sphere>(point3( 0.0, -0.25, -0), -0.15,     material_water));
+	world.add(std::make_shared<sphere>(point3(-0.5,   0.0, -1),   0.5,     material_left));
+	world.add(std::make_shared<sphere>(point3(-0.5,   0.0, -1),  -0.3,     material_left));
+	world.add(std::make_shared<sphere>(point3( 0.0,-100.5, -1), 100.0,     material_ground));
+
+	return world;
+}
+
+hittable_list mesh_scene()
+{
+	hittable_list world;
+
+	// Rolling terrain as a triangle mesh, 2 * 256 * 256 triangles.
+	auto ground_material = std::make_shared<lambertian>(color(0.35, 0.45, 0.3));
+	const int n = 256;
+	const double size = 24.0;
+	auto height = [](double x, double z)
+	{
+		return 0.25 * std::sin(0.9*x) * std::cos(0.7*z) + 0.1 * std::sin(2.3*x + 1.7*z) - 0.3;
+	};
+	auto grid = [&](int i, int k)
+	{
+		double x = size * (static_cast<double>(i) / n - 0.5);
+		double z = size * (static_cast<double>(k) / n - 0.5);
+		return point3(x, height(x, z), z);
+	};
+	for (int k = 0; k < n; ++k)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			world.add(std::make_shared<triangle>(grid(i, k), grid(i, k+1), grid(i+1, k+1), ground_material));
+			world.add(std::make_shared<triangle>(grid(i, k), grid(i+1, k+1), grid(i+1, k), ground_material));
+		}
+	}
+
+	// A tessellated metal sphere, 2 * 96 * 48 triangles.
+	auto sphere_material = std::make_shared<metal>(color(0.8, 0.7, 0.6), 0.05);
+	const point3 center(0, 1, 0);
+	const int slices = 96, stacks = 48;
+	auto on_sphere = [&](int s, int t)
+	{
+		double phi = 2 * pi * s / slices;
+		double theta = pi * t / stacks;
+		return center + vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+	};
+	for (int t = 0; t < stacks; ++t)
+	{
+		for (int s = 0; s < slices; ++s)
+		{
+			world.add(std::make_shared<triangle>(on_sphere(s, t), on_sphere(s+1, t), on_sphere(s+1, t+1), sphere_material));
+			world.add(std::make_shared<triangle>(on_sphere(s, t), on_sphere(s+1, t+1), on_sphere(s, t+1), sphere_material));
+		}
+	}
+
+	world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, std::make_shared<dielectric>(1.5)));
+	world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, std::make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+
+	return world;
+}
+
+//!	function for a closed room lit only through a hole in the ceiling, hard for BSDF sampling.
+hittable_list window_scene()
+{
+	hittable_list world;
+
+	auto wall_material = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+	auto quad = [&](point3 a, point3 b, point3 c, point3 d)
+	{
+		world.add(std::make_shared<triangle>(a, b, c, wall_material));
+		world.add(std::make_shared<triangle>(a, c, d, wall_material));
+	};
+
+	// Walls and floor around the default camera, the ceiling at y = 8 has a 4 by 4 hole.
+	const double r = 16, floor_y = -0.5, ceiling_y = 8, hole = 2;
+	quad(point3(-r, floor_y, -r), point3(r, floor_y, -r), point3(r, floor_y, r), point3(-r, floor_y, r));
+	quad(point3(-r, floor_y, -r), point3(-r, ceiling_y, -r), point3(r, ceiling_y, -r), point3(r, floor_y, -r));
+	quad(point3(-r, floor_y, r), point3(r, floor_y, r), point3(r, ceiling_y, r), point3(-r, ceiling_y, r));
+	quad(point3(-r, floor_y, -r), point3(-r, floor_y, r), point3(-r, ceiling_y, r), point3(-r, ceiling_y, -r));
+	quad(point3(r, floor_y, -r), point3(r, ceiling_y, -r), point3(r, ceiling_y, r), point3(r, floor_y, r));
+	quad(point3(-r, ceiling_y, -r), point3(-r, ceiling_y, r), point3(-hole, ceiling_y, r), point3(-hole, ceiling_y, -r));
+	quad(point3(hole, ceiling_y, -r), point3(hole, ceiling_y, r), point3(r, ceiling_y, r), point3(r, ceiling_y, -r));
+	quad(point3(-hole, ceiling_y, -r), point3(-hole, ceiling_y, -hole), point3(hole, ceiling_y, -hole), point3(hole, ceiling_y, -r));
+	quad(point3(-hole, ceiling_y, hole), point3(-hole, ceiling_y, r), point3(hole, ceiling_y, r), point3(hole, ceiling_y, hole));
+
+	world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, std::make_shared<dielectric>(1.5)));
+	world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, std::make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+	world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0)));
+
+	return world;
+}
+
+//!	function to tell whether build_scene() knows a name, without building anything.
+inline bool known_scene(const std::string& name)
+{
+	return name == "cover" || name == "my" || name == "mesh" || name == "window";
+}
+
+//!	function to build a scene by name, the same name and seed always give the same scene.
+/*!
+	\param name std::string& "cover", "my", "mesh" or "window".
+	\param seed uint64_t seed for the random placement in cover_scene.
+	\return shared_ptr<hittable_list> the scene, or nullptr for an unknown name.
+*/
+std::shared_ptr<hittable_list> build_scene(const std::string& name, uint64_t seed = 0)
+{
+	std::shared_ptr<hittable_list> world;
+	seed_random(seed);
+	if (name == "cover")
+	{
+		world = std::make_shared<hittable_list>(cover_scene());
+	}
+	else if (name == "my")
+	{
+		world = std::make_shared<hittable_list>(my_scene());
+	}
+	else if (name == "mesh")
+	{
+		world = std::make_shared<hittable_list>(mesh_scene());
+	}
+	else if (name == "window")
+	{
+		world = std::make_shared<hittable_list>(window_scene());
+	}
+	else
+	{
+		return nullptr;
+	}
+
+	auto material_ground = std::make_shared<lambertian>(color(1,0,0));
+	world->add(std::make_shared<triangle>(vec3(0,-0.25,0),vec3(1,-0.25,0),vec3(1,0.75,0),material_ground));
+
+	return world;
+}
+
+#endif
@@ -0,0 +1,447 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "output_sink.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//!	scene_cache struct.
+/*!
+	Built scenes, acceleration structure included, kept around between jobs, keyed by
+	everything that decides their contents. Lookups for a scene that is still being built wait on that build
+	instead of starting a second one. The least recently used scene is dropped once more
+	than capacity are held, jobs still rendering it keep their own reference.
+*/
+typedef struct scene_cache
+{
+	typedef std::shared_future<std::shared_ptr<const hittable>> entry;
+
+	size_t capacity;
+	std::atomic<size_t> hits{0};
+	std::atomic<size_t> misses{0};
+
+	scene_cache(size_t c) : capacity(c) {}
+
+	static std::string key(const std::string& name, uint64_t seed)
+	{
+		return name + ':' + std::to_string(seed);
+	}
+
+	std::shared_ptr<const hittable> get(const std::string& name, uint64_t seed);
+
+	private:
+	std::mutex m;
+	std::list<std::pair<std::string, entry>> lru;	// front is the most recently used
+	std::unordered_map<std::string, std::list<std::pair<std::string, entry>>::iterator> index;
+} scene_cache;
+
+//!	function to return the scene for name and seed, building it on a miss.
+/*!
+	\return shared_ptr<const hittable> the scene, nullptr if name is not a known scene.
+*/
+std::shared_ptr<const hittable> scene_cache::get(const std::string& name, uint64_t seed)
+{
+	if (!known_scene(name))
+	{
+		return nullptr;	// checked up front so unknown names never push real scenes out
+	}
+
+	std::string k = key(name, seed);
+	std::promise<std::shared_ptr<const hittable>> building;
+	entry e;
+	bool build = false;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		auto found = index.find(k);
+		if (found != index.end())
+		{
+			++hits;
+			lru.splice(lru.begin(), lru, found->second);
+			e = found->second->second;
+		}
+		else
+		{
+			++misses;
+			build = true;
+			e = building.get_future().share();
+			lru.push_front(std::make_pair(k, e));
+			index[k] = lru.begin();
+			while (lru.size() > capacity)
+			{
+				index.erase(lru.back().first);
+				lru.pop_back();
+			}
+		}
+	}
+
+	// Build outside the lock, anyone else asking for the same scene waits on the future.
+	if (build)
+	{
+		building.set_value(accelerate(build_scene(name, seed)));
+	}
+	return e.get();
+}
+
+//!	service_request struct.
+/*!
+	One job as sent by a client, a single line of key=value pairs such as
+		render scene=cover seed=0 width=640 spp=100 priority=5 lookfrom=13,2,3
+	Anything not given keeps the defaults below. Sizes are capped so one request cannot
+	tie the service up or run it out of memory.
+*/
+typedef struct service_request
+{
+	static const int max_size = 8192;		// width and height
+	static const int max_samples = 1 << 16;
+	static const int max_bounces = 1000;
+
+	std::string scene = "cover";
+	uint64_t seed = 0;
+	int priority = 0;	// higher runs first
+	render_settings settings;
+
+	point3 lookfrom = point3(13,2,3);
+	point3 lookat = point3(0,0,0);
+	double vfov = 20;
+	double aperture = 0.1;
+	double dist_to_focus = 13.5;
+
+	camera make_camera() const
+	{
+		auto aspect_ratio = static_cast<double>(settings.image_width) / settings.image_height;
+		return camera(lookfrom, lookat, vec3(0,1,0), vfov, aspect_ratio, aperture, dist_to_focus);
+	}
+
+	bool parse(const std::string& line);
+} service_request;
+
+//!	function to fill in the request from a "render key=value ..." line.
+/*!
+	\return bool false if the line is not a render request or a value does not parse or is out of range.
+*/
+bool service_request::parse(const std::string& line)
+{
+	std::istringstream in(line);
+	std::string word;
+	if (!(in >> word) || word != "render")
+	{
+		return false;
+	}
+
+	bool height_given = false;
+	while (in >> word)
+	{
+		auto eq = word.find('=');
+		if (eq == std::string::npos)
+		{
+			return false;
+		}
+		std::string k = word.substr(0, eq);
+		const char* v = word.c_str() + eq + 1;
+
+		if      (k == "scene")		scene = v;
+		else if (k == "seed")		seed = std::strtoull(v, nullptr, 10);
+		else if (k == "priority")	priority = std::atoi(v);
+		else if (k == "width")		settings.image_width = std::atoi(v);
+		else if (k == "height")		{ settings.image_height = std::atoi(v); height_given = true; }
+		else if (k == "spp")		settings.samples_per_pixel = std::atoi(v);
+		else if (k == "depth")		settings.max_depth = std::atoi(v);
+		else if (k == "vfov")		vfov = std::atof(v);
+		else if (k == "aperture")	aperture = std::atof(v);
+		else if (k == "focus")		dist_to_focus = std::atof(v);
+		else if (k == "lookfrom")
+		{
+			if (std::sscanf(v, "%lf,%lf,%lf", &lookfrom[0], &lookfrom[1], &lookfrom[2]) != 3)
+			{
+				return false;
+			}
+		}
+		else if (k == "lookat")
+		{
+			if (std::sscanf(v, "%lf,%lf,%lf", &lookat[0], &lookat[1], &lookat[2]) != 3)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	if (!height_given)
+	{
+		settings.image_height = static_cast<int>(settings.image_width / (16.0 / 9.0));
+	}
+	return settings.image_width > 1 && settings.image_width <= max_size && settings.image_height > 1 && settings.image_height <= max_size
+		&& settings.samples_per_pixel > 0 && settings.samples_per_pixel <= max_samples && settings.max_depth > 0 && settings.max_depth <= max_bounces;
+}
+
+#ifndef _WIN32
+
+//!	socket_sink struct.
+/*!
+	Streams a job's rows back over the client's connection as a plain text PPM. A failed
+	write marks the sink broken so the job can be cancelled once the client has gone.
+*/
+typedef struct socket_sink : output_sink
+{
+	int fd;
+	std::atomic<bool> broken{false};
+
+	socket_sink(int f) : fd(f) {}
+
+	void send_all(const std::string& data)
+	{
+		size_t sent = 0;
+		while (!broken && sent < data.size())
+		{
+			auto n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if (n <= 0)
+			{
+				broken = true;
+				return;
+			}
+			sent += n;
+		}
+	}
+
+	virtual void begin(int image_width, int image_height) override
+	{
+		send_all("P3\n" + std::to_string(image_width) + ' ' + std::to_string(image_height) + "\n255\n");
+	}
+
+	virtual void write_row(int /*row*/, const std::vector<color>& pixels, int samples_per_pixel) override
+	{
+		std::ostringstream line;
+		for (const auto& pixel_color : pixels)
+		{
+			write_color(line, pixel_color, samples_per_pixel);
+		}
+		send_all(line.str());
+	}
+
+	virtual void end() override {}
+} socket_sink;
+
+#endif
+
+//!	render_service struct.
+/*!
+	A long running renderer listening on a Unix socket. Each connection sends one line,
+	either a render request or "stats", and gets back the image streamed as rows finish,
+	or a single line starting with "error". Requests wait in a queue ordered by priority,
+	at most max_running of them render at a time on the shared pool, and scenes come from
+	a scene_cache so repeat jobs on the same scene skip construction entirely.
+*/
+typedef struct render_service
+{
+	static const size_t max_line = 4096;	// longest request line read, longer ones are refused
+
+	thread_pool& pool;
+	scene_cache scenes;
+	int max_running;
+
+	render_service(thread_pool& p, size_t cached_scenes = 4, int running = 2) : pool(p), scenes(cached_scenes), max_running(running) {}
+
+	bool serve(const std::string& socket_path);
+
+	private:
+	typedef struct queued
+	{
+		int priority;
+		uint64_t order;		// ties go first come first served
+		std::function<void()> start;
+
+		bool operator<(const queued& other) const
+		{
+			return priority != other.priority ? priority < other.priority : order > other.order;
+		}
+	} queued;
+
+	std::mutex m;
+	std::condition_variable cv;
+	std::priority_queue<queued> waiting;
+	uint64_t submitted = 0;
+	int running = 0;
+
+	void dispatch();
+	void handle(int fd);
+	void enqueue(int priority, std::function<void()> start);
+	void job_done();
+} render_service;
+
+void render_service::enqueue(int priority, std::function<void()> start)
+{
+	std::lock_guard<std::mutex> lock(m);
+	waiting.push(queued{priority, submitted++, std::move(start)});
+	cv.notify_all();
+}
+
+void render_service::job_done()
+{
+	std::lock_guard<std::mutex> lock(m);
+	--running;
+	cv.notify_all();
+}
+
+// Starts the highest priority request whenever fewer than max_running are rendering.
+void render_service::dispatch()
+{
+	while (true)
+	{
+		std::function<void()> start;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			cv.wait(lock, [&]{ return !waiting.empty() && running < max_running; });
+			start = waiting.top().start;
+			waiting.pop();
+			++running;
+		}
+		start();
+	}
+}
+
+#ifndef _WIN32
+
+void render_service::handle(int fd)
+{
+	std::string line;
+	char c;
+	bool too_long = false;
+	while (::recv(fd, &c, 1, 0) == 1 && c != '\n')
+	{
+		if (line.size() == max_line)
+		{
+			too_long = true;
+			break;
+		}
+		line += c;
+	}
+
+	socket_sink reply(fd);
+	service_request request;
+	if (too_long)
+	{
+		reply.send_all("error request too long\n");
+	}
+	else if (line == "stats")
+	{
+		reply.send_all("scene cache hits " + std::to_string(scenes.hits) + " misses " + std::to_string(scenes.misses) + '\n');
+	}
+	else if (!request.parse(line))
+	{
+		reply.send_all("error bad request\n");
+	}
+	else if (!known_scene(request.scene))
+	{
+		reply.send_all("error unknown scene\n");
+	}
+	else
+	{
+		// The scene is built here on the connection's own thread before the job is queued,
+		// so a slow build holds up only this client and the dispatcher just launches jobs.
+		// A burst of requests for a new scene still builds it once, the others wait on it
+		// in the cache.
+		auto world = scenes.get(request.scene, request.seed);
+		std::promise<std::shared_ptr<render_job>> started;
+		auto sink = std::make_shared<socket_sink>(fd);
+		enqueue(request.priority, [&]()
+		{
+			started.set_value(render_job::launch(pool, world, request.make_camera(), request.settings, sink));
+		});
+
+		auto job = started.get_future().get();
+		while (job->future().wait_for(std::chrono::milliseconds(100)) != std::future_status::ready)
+		{
+			if (sink->broken)
+			{
+				job->cancel();
+			}
+		}
+		job->wait();
+		job_done();
+	}
+
+	::close(fd);
+}
+
+//!	function to listen on socket_path and serve requests until the process is killed.
+/*!
+	\return bool false if the socket could not be set up.
+*/
+bool render_service::serve(const std::string& socket_path)
+{
+	int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+	{
+		return false;
+	}
+
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(addr.sun_path))
+	{
+		::close(listener);
+		return false;
+	}
+	socket_path.copy(addr.sun_path, socket_path.size());
+	::unlink(socket_path.c_str());
+
+	if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listener, 16) != 0)
+	{
+		::close(listener);
+		return false;
+	}
+
+	std::thread(&render_service::dispatch, this).detach();
+	while (true)
+	{
+		int fd = ::accept(listener, nullptr, nullptr);
+		if (fd < 0)
+		{
+			continue;
+		}
+		std::thread(&render_service::handle, this, fd).detach();
+	}
+}
+
+#else
+
+// Windows has no Unix socket support here yet.
+void render_service::handle(int fd) {}
+
+bool render_service::serve(const std::string& socket_path)
+{
+	return false;
+}
+
+#endif
+
+#endif
@@ -14,6 +14,8 @@ typedef struct sphere : hittable
 	sphere(point3 cen, double r, std::shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
 
 } sphere;
 
@@ -51,5 +53,32 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 	return true;
 }
 
+bool sphere::occluded(const ray& r, double t_min, double t_max) const
+{
+	vec3 oc = r.origin() - center;
+	auto a = r.direction().length_squared();
+	auto half_b = dot(oc, r.direction());
+	auto c = oc.length_squared() - radius*radius;
+
+	auto discriminant = half_b*half_b - a*c;
+	if (discriminant < 0)
+	{
+		return false;
+	}
+	auto sqrtd = std::sqrt(discriminant);
+
+	// Either root in range will do.
+	auto near_root = (-half_b - sqrtd) / a;
+	auto far_root = (-half_b + sqrtd) / a;
+	return (t_min <= near_root && near_root <= t_max) || (t_min <= far_root && far_root <= t_max);
+}
+
+bool sphere::bounding_box(aabb& output_box) const
+{
+	// Negative radii are used for hollow glass, the box is the same.
+	auto r = std::fabs(radius);
+	output_box = aabb(center - vec3(r, r, r), center + vec3(r, r, r));
+	return true;
+}
 
 #endif
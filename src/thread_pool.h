@@ -0,0 +1,138 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "affinity.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//!	thread_pool struct.
+/*!
+	A fixed set of worker threads fed from one FIFO task queue. Every render job and
+	preview submits its work here instead of starting threads of its own, so any number
+	of concurrent jobs never runs more threads than the pool was created with.
+
+	Workers can be pinned to hardware threads, compact or scattered over the NUMA nodes,
+	each one then records its node in current_numa_node() so per node data can be picked.
+*/
+typedef struct thread_pool
+{
+	thread_pool(size_t num_threads = std::thread::hardware_concurrency(), pinning mode = PIN_NONE);
+	~thread_pool();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	size_t size() const
+	{
+		return workers.size();
+	}
+
+	void submit(std::function<void()> task);
+	void parallel(std::function<void()> task);
+
+	private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex m;
+	std::condition_variable cv;
+	bool quit = false;
+
+	void work(int cpu, int node);
+} thread_pool;
+
+thread_pool::thread_pool(size_t num_threads, pinning mode)
+{
+	if (num_threads == 0)
+	{
+		num_threads = 1;
+	}
+
+	auto topology = numa_topology::detect();
+	auto cpus = topology.placement(mode, num_threads);
+	for (size_t i = 0; i < num_threads; ++i)
+	{
+		int node = cpus[i] < 0 ? 0 : topology.node_of(cpus[i]);
+		workers.push_back(std::thread(&thread_pool::work, this, cpus[i], node));
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		quit = true;
+	}
+	cv.notify_all();
+	for (auto& th : workers)
+	{
+		th.join();
+	}
+}
+
+//!	function to queue a task, it runs on whichever worker frees up first.
+void thread_pool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		tasks.push_back(std::move(task));
+	}
+	cv.notify_one();
+}
+
+//!	function to run task once per worker and block until all copies have returned.
+/*!
+	The tasks are meant to pull their work from a shared counter. Must not be called from
+	inside a pool task, the caller would be waiting on a slot it is holding.
+*/
+void thread_pool::parallel(std::function<void()> task)
+{
+	std::mutex done_m;
+	std::condition_variable done_cv;
+	size_t remaining = size();
+
+	for (size_t i = 0; i < size(); ++i)
+	{
+		submit([&]()
+		{
+			task();
+			std::lock_guard<std::mutex> lock(done_m);
+			if (--remaining == 0)
+			{
+				done_cv.notify_all();
+			}
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(done_m);
+	done_cv.wait(lock, [&]{ return remaining == 0; });
+}
+
+void thread_pool::work(int cpu, int node)
+{
+	pin_current_thread(cpu);
+	current_numa_node() = node;
+
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			cv.wait(lock, [&]{ return quit || !tasks.empty(); });
+			if (tasks.empty())
+			{
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+#endif
@@ -1,60 +1,256 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
+#include "rtweekend.h"
+
 #include "hittable.h"
-#include "vec3.h"
 
+#include <utility>
+
+//!	watertight_ray struct.
+/*!
+	The per-ray part of the watertight test from Woop, Benthin and Wald, "Watertight
+	Ray/Triangle Intersection" (JCGT 2013). The ray is sheared so it runs along +z, which
+	turns the triangle test into 2D edge functions evaluated the same way for both
+	triangles sharing an edge, so a ray can never slip through the crack between them.
+	Built once per ray and shared by every triangle it is tested against.
+*/
+typedef struct watertight_ray
+{
+	point3 orig;
+	int kx, ky, kz;
+	double sx, sy, sz;
+
+	watertight_ray() {}
+	watertight_ray(const ray& r) : orig(r.origin())
+	{
+		vec3 d = r.direction();
+
+		// z is the dominant axis of the direction, x and y keep the winding.
+		kz = std::fabs(d.x()) > std::fabs(d.y()) ? (std::fabs(d.x()) > std::fabs(d.z()) ? 0 : 2) : (std::fabs(d.y()) > std::fabs(d.z()) ? 1 : 2);
+		kx = kz == 2 ? 0 : kz + 1;
+		ky = kx == 2 ? 0 : kx + 1;
+		if (d[kz] < 0)
+		{
+			std::swap(kx, ky);
+		}
+
+		sx = d[kx] / d[kz];
+		sy = d[ky] / d[kz];
+		sz = 1.0 / d[kz];
+	}
+} watertight_ray;
+
+//!	triangle struct.
+/*!
+	The vertices are baked into an aligned record together with the geometric normal when
+	the scene is built, so a hit never has to derive anything from them. The vertices are
+	kept as given rather than as v0 plus edges, since neighbouring triangles have to see
+	bitwise identical shared vertices for the test to stay watertight.
+*/
 typedef struct triangle : hittable
 {
-	vec3 v[3];
+	typedef struct alignas(32) baked
+	{
+		point3 v0, v1, v2;
+		vec3 normal;	// unit, counter-clockwise winding faces out
+	} baked;
+
+	baked tri;
 	std::shared_ptr<material> mat_ptr;
 
 	triangle() {}
-	triangle(vec3 v0, vec3 v1, vec3 v2, std::shared_ptr<material> m) : v{v0, v1, v2}, mat_ptr(m) {};
+	triangle(vec3 v0, vec3 v1, vec3 v2, std::shared_ptr<material> m) : mat_ptr(m)
+	{
+		tri.v0 = v0;
+		tri.v1 = v1;
+		tri.v2 = v2;
+		tri.normal = unit_vector(cross(v1 - v0, v2 - v0));
+	}
+
+	bool intersect(const watertight_ray& wr, double t_min, double t_max, double& t) const;
+	void fill_record(const ray& r, double t, hit_record& rec) const;
 
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
 } triangle;
 
-// Moller-Trumbore ray-triangle intersection algorithm
-bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+//!	function for the watertight ray-triangle test.
+/*!
+	\param wr watertight_ray& the sheared ray.
+	\param v0 point3& first vertex.
+	\param v1 point3& second vertex.
+	\param v2 point3& third vertex.
+	\param t_min double lower end of the accepted range.
+	\param t_max double upper end of the accepted range.
+	\param t double& receives the ray parameter of the hit.
+	\return bool true if the ray hits the triangle inside the range, from either side.
+*/
+inline bool intersect_triangle(const watertight_ray& wr, const point3& v0, const point3& v1, const point3& v2, double t_min, double t_max, double& t)
 {
-	const double EPSILON = 0.0000001;
-	vec3 v0 = v[0];
-	vec3 v1 = v[1];
-	vec3 v2 = v[2];
-	vec3 edge1, edge2, h, s, q;
-	double a, f, u, v;
-	edge1 = v1 - v0;
-	edge2 = v2 - v1;
-	h = cross(r.direction(), edge2);
-	a = dot(edge1, h);
-	if (a > -EPSILON && a < EPSILON)
+	vec3 a = v0 - wr.orig;
+	vec3 b = v1 - wr.orig;
+	vec3 c = v2 - wr.orig;
+
+	double ax = a[wr.kx] - wr.sx*a[wr.kz];
+	double ay = a[wr.ky] - wr.sy*a[wr.kz];
+	double bx = b[wr.kx] - wr.sx*b[wr.kz];
+	double by = b[wr.ky] - wr.sy*b[wr.kz];
+	double cx = c[wr.kx] - wr.sx*c[wr.kz];
+	double cy = c[wr.ky] - wr.sy*c[wr.kz];
+
+	// Scaled barycentrics, all must share a sign. Exact zeros count for both sides,
+	// which is what keeps hits on a shared edge from being lost.
+	double u = cx*by - cy*bx;
+	double v = ax*cy - ay*cx;
+	double w = bx*ay - by*ax;
+	if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+	{
+		return false;
+	}
+
+	double det = u + v + w;
+	if (det == 0)
 	{
 		return false;	// ray parallel to triangle
 	}
-	f = 1.0/a;
-	s = r.origin() - v0;
-	u = f * dot(s, h);
-	if (u < 0.0 || u > 1.0)
+
+	double scaled_t = u*wr.sz*a[wr.kz] + v*wr.sz*b[wr.kz] + w*wr.sz*c[wr.kz];
+	t = scaled_t / det;
+	return t_min <= t && t <= t_max;
+}
+
+bool triangle::intersect(const watertight_ray& wr, double t_min, double t_max, double& t) const
+{
+	return intersect_triangle(wr, tri.v0, tri.v1, tri.v2, t_min, t_max, t);
+}
+
+void triangle::fill_record(const ray& r, double t, hit_record& rec) const
+{
+	rec.t = t;
+	rec.p = r.at(t);
+	rec.set_face_normal(r, tri.normal);
+	rec.mat_ptr = mat_ptr;
+}
+
+bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+	double t;
+	if (!intersect(watertight_ray(r), t_min, t_max, t))
 	{
 		return false;
 	}
-	q = cross(s, edge1);
-	v = f * dot(r.direction(), q);
-	if (v < 0.0 || u + v > 1.0)
+	fill_record(r, t, rec);
+	return true;
+}
+
+bool triangle::occluded(const ray& r, double t_min, double t_max) const
+{
+	double t;
+	return intersect(watertight_ray(r), t_min, t_max, t);
+}
+
+bool triangle::bounding_box(aabb& output_box) const
+{
+	output_box = surrounding_box(aabb(tri.v0, tri.v0), surrounding_box(aabb(tri.v1, tri.v1), aabb(tri.v2, tri.v2)));
+	return true;
+}
+
+//!	triangle4 struct.
+/*!
+	Four triangles in structure of arrays form for acceleration structure leaves. The lanes
+	are tested together with the same watertight test as triangle::intersect, written as
+	one branch free loop over the lanes so it compiles to 4-wide SIMD. Unused lanes hold
+	a degenerate triangle, which never hits.
+*/
+typedef struct alignas(32) triangle4
+{
+	double v0[3][4];
+	double v1[3][4];
+	double v2[3][4];
+	const triangle* tris[4];
+
+	triangle4()
 	{
-		return false;
+		for (int k = 0; k < 3; ++k)
+		{
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				v0[k][lane] = v1[k][lane] = v2[k][lane] = 0;
+			}
+		}
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			tris[lane] = nullptr;
+		}
 	}
-	double t = f * dot(edge2, q);
-	if (t > EPSILON) // ray intersection
+
+	void set(int lane, const triangle* t)
 	{
-		rec.t = t;
-		rec.p = r.origin() + r.direction() * t;
-		rec.mat_ptr = mat_ptr;
-		return true;
+		for (int k = 0; k < 3; ++k)
+		{
+			v0[k][lane] = t->tri.v0[k];
+			v1[k][lane] = t->tri.v1[k];
+			v2[k][lane] = t->tri.v2[k];
+		}
+		tris[lane] = t;
 	}
-	return false;
-}
 
+	int intersect(const watertight_ray& wr, double t_min, double t_max, double& t) const;
+} triangle4;
+
+//!	function to test a ray against all four lanes.
+/*!
+	\param t double& receives the ray parameter of the closest hit.
+	\return int the lane of the closest hit inside [t_min, t_max], or -1.
+*/
+int triangle4::intersect(const watertight_ray& wr, double t_min, double t_max, double& t) const
+{
+	alignas(32) double lane_t[4];
+
+	// Pick the sheared axes once, so the lane loop only does unit stride loads.
+	const double* ax_ = v0[wr.kx]; const double* ay_ = v0[wr.ky]; const double* az_ = v0[wr.kz];
+	const double* bx_ = v1[wr.kx]; const double* by_ = v1[wr.ky]; const double* bz_ = v1[wr.kz];
+	const double* cx_ = v2[wr.kx]; const double* cy_ = v2[wr.ky]; const double* cz_ = v2[wr.kz];
+	const double ox = wr.orig[wr.kx], oy = wr.orig[wr.ky], oz = wr.orig[wr.kz];
+
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		double az = az_[lane] - oz;
+		double bz = bz_[lane] - oz;
+		double cz = cz_[lane] - oz;
+
+		double ax = (ax_[lane] - ox) - wr.sx*az;
+		double ay = (ay_[lane] - oy) - wr.sy*az;
+		double bx = (bx_[lane] - ox) - wr.sx*bz;
+		double by = (by_[lane] - oy) - wr.sy*bz;
+		double cx = (cx_[lane] - ox) - wr.sx*cz;
+		double cy = (cy_[lane] - oy) - wr.sy*cz;
+
+		double u = cx*by - cy*bx;
+		double v = ax*cy - ay*cx;
+		double w = bx*ay - by*ax;
+		double det = u + v + w;
+		double lt = (u*az + v*bz + w*cz) * wr.sz / det;
+
+		bool mixed = ((u < 0) | (v < 0) | (w < 0)) & ((u > 0) | (v > 0) | (w > 0));
+		bool valid = !mixed & (det != 0) & (t_min <= lt) & (lt <= t_max);
+		lane_t[lane] = valid ? lt : infinity;
+	}
+
+	int best = -1;
+	double closest = infinity;
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		if (lane_t[lane] < closest)
+		{
+			closest = lane_t[lane];
+			best = lane;
+		}
+	}
+	t = closest;
+	return best;
+}
 
 #endif
@@ -280,31 +280,32 @@ inline static vec3 random_vec3(double min, double max)
 	return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
 }
 
-//!	function to generate and return a random vector with length >= 1.
+//!	function to generate a random unit vector, uniformly distributed over the sphere.
 /*!
-	\return a vec3 random vec3.
+	Closed form using spherical coordinates, z is uniform in [-1,1] and phi in [0,2pi),
+	so it always consumes exactly two random numbers and has no loop or branch.
+	\return a random unit vec3
 */
-vec3 random_in_unit_sphere()
+vec3 random_unit_vector()
 {
-	for (;;)
-	{
-		auto p = random_vec3(-1,1);
-		if (p.length_squared() >= 1)
-		{
-			continue;
-		}
-		return p;
-	}
+	auto z = 1 - 2*random_double();
+	auto phi = 2*pi*random_double();
+	auto r = std::sqrt(std::fmax(0.0, 1 - z*z));
+	return vec3(r*std::cos(phi), r*std::sin(phi), z);
 }
 
-//!	function to generate random unit vector.
+//!	function to generate a random vector uniformly distributed inside the unit sphere.
 /*!
-	\return a random unit vec3
+	A uniform direction scaled by the cube root of a uniform number, which gives equal
+	density per unit of volume.
+	\return a vec3 with length < 1.
 */
-vec3 random_unit_vector()
+vec3 random_in_unit_sphere()
 {
-	return unit_vector(random_in_unit_sphere());
+	auto r = std::cbrt(random_double());
+	return r * random_unit_vector();
 }
+
 //!	function to return a random unit sphere, use for hemispherical scattering.
 /*!
  	\param normal vec3& normal to compare against the generated sphere.
@@ -313,18 +314,14 @@ vec3 random_unit_vector()
 vec3 random_in_hemisphere(const vec3& normal)
 {
 	vec3 in_unit_sphere = random_in_unit_sphere();
-	if (dot(in_unit_sphere, normal) > 0.0)	// In the same hemisphere as the normal
-	{
-		return in_unit_sphere;
-	}
-	else
-	{
-		return -in_unit_sphere;
-	}
+	// Flip into the same hemisphere as the normal.
+	return std::copysign(1.0, dot(in_unit_sphere, normal)) * in_unit_sphere;
 }
 
 //!	function to return random unit in a disk, use for calculating depth of field.
 /*!
+	Rejection sampling from the square. Unlike the sphere it needs no trig, and the loop
+	is taken again only 21% of the time, so it beats the closed form mappings.
 	\return vec3 representing said unit in disk.
 */
 vec3 random_in_unit_disk()
@@ -332,11 +329,10 @@ vec3 random_in_unit_disk()
 	while (true)
 	{
 		auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-		if (p.length_squared() >= 1)
+		if (p.length_squared() < 1)
 		{
-			continue;
+			return p;
 		}
-		return p;
 	}
 }
 